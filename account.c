@@ -0,0 +1,294 @@
+/**
+ * dapper - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * account.c
+ * Copyright (C) 2012-2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of dapper.
+ *
+ * dapper is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * dapper is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * dapper. If not, see http://www.gnu.org/licenses/
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "config.h"
+#include "dapper.h"
+#include "account.h"
+
+/* an application using less CPU than that (in % of a sampling interval) is
+ * considered settled */
+#define IDLE_PERCENT    2
+
+void
+account_start (account_t *acct, const char *name, pid_t pid, long now)
+{
+    memset (acct, 0, sizeof (*acct));
+    acct->name = name;
+    acct->pid = pid;
+    acct->start = now;
+    acct->end = acct->settle = acct->sampled = -1;
+}
+
+/* reads file /proc/<pid>/<name> into buf; returns its length or -1 */
+static ssize_t
+read_proc (pid_t pid, const char *name, char *buf, size_t len)
+{
+    char    path[64];
+    FILE   *fp;
+    size_t  l;
+
+    snprintf (path, sizeof (path), "/proc/%d/%s", (int) pid, name);
+    if (!(fp = fopen (path, "r")))
+    {
+        return -1;
+    }
+    l = fread (buf, 1, len - 1, fp);
+    fclose (fp);
+    buf[l] = '\0';
+    return (ssize_t) l;
+}
+
+/* value (as a number) of field key in buf, made of lines "Key: value..." */
+static unsigned long long
+get_field (const char *buf, const char *key)
+{
+    size_t      l = strlen (key);
+    const char *s;
+
+    for (s = buf; s; s = strchr (s, '\n'))
+    {
+        if (*s == '\n')
+        {
+            ++s;
+        }
+        if (strncmp (s, key, l) == 0 && s[l] == ':')
+        {
+            return strtoull (s + l + 1, NULL, 10);
+        }
+    }
+    return 0;
+}
+
+/* samples CPU time, RSS & IO of a running application */
+void
+account_sample (account_t *acct, long now)
+{
+    unsigned long long  ticks;
+    unsigned long long  n;
+    long                hz = sysconf (_SC_CLK_TCK);
+    char                buf[4096];
+    char               *s;
+    int                 i;
+
+    if (acct->pid <= 0)
+    {
+        return;
+    }
+
+    /* utime & stime are fields 14 & 15, and comm (2nd) could have spaces */
+    if (read_proc (acct->pid, "stat", buf, sizeof (buf)) > 0
+            && (s = strrchr (buf, ')')))
+    {
+        for (i = 2; i < 14 && s; ++i)
+        {
+            if ((s = strchr (s + 1, ' ')))
+            {
+                ++s;
+            }
+        }
+        if (s)
+        {
+            ticks = strtoull (s, &s, 10);
+            ticks += strtoull (s, NULL, 10);
+            acct->cpu = ticks * 1000 / (unsigned long long) hz;
+            /* settled once it spent (nearly) a whole interval idle */
+            if (acct->settle < 0 && acct->sampled >= 0 && now > acct->sampled
+                    && (ticks - acct->ticks) * 1000 / (unsigned long long) hz * 100
+                    <= (unsigned long long) (now - acct->sampled) * IDLE_PERCENT)
+            {
+                acct->settle = acct->sampled;
+            }
+            acct->ticks = ticks;
+            acct->sampled = now;
+        }
+    }
+
+    if (read_proc (acct->pid, "smaps_rollup", buf, sizeof (buf)) > 0
+            && (long) (n = get_field (buf, "Rss")) > acct->rss)
+    {
+        acct->rss = (long) n;
+    }
+
+    /* only readable for our own processes, which they should be */
+    if (read_proc (acct->pid, "io", buf, sizeof (buf)) > 0)
+    {
+        if ((n = get_field (buf, "read_bytes")) > acct->io_read)
+        {
+            acct->io_read = n;
+        }
+        if ((n = get_field (buf, "write_bytes")) > acct->io_write)
+        {
+            acct->io_write = n;
+        }
+    }
+}
+
+/* application was reaped; ru (from wait4) also accounts for whatever children
+ * of its own it waited for */
+void
+account_exited (account_t *acct, int status, const struct rusage *ru, long now)
+{
+    unsigned long long n;
+
+    acct->pid = 0;
+    acct->end = now;
+    acct->status = status;
+    if (acct->settle < 0)
+    {
+        acct->settle = now;
+    }
+    n = (unsigned long long) (ru->ru_utime.tv_sec + ru->ru_stime.tv_sec) * 1000
+        + (unsigned long long) (ru->ru_utime.tv_usec + ru->ru_stime.tv_usec) / 1000;
+    if (n > acct->cpu)
+    {
+        acct->cpu = n;
+    }
+    if (ru->ru_maxrss > acct->rss)
+    {
+        acct->rss = ru->ru_maxrss;
+    }
+    /* in blocks of 512 bytes */
+    if ((n = (unsigned long long) ru->ru_inblock * 512) > acct->io_read)
+    {
+        acct->io_read = n;
+    }
+    if ((n = (unsigned long long) ru->ru_oublock * 512) > acct->io_write)
+    {
+        acct->io_write = n;
+    }
+}
+
+static int
+cmp_cpu (const void *a1, const void *a2)
+{
+    const account_t *acct1 = *(account_t * const *) a1;
+    const account_t *acct2 = *(account_t * const *) a2;
+
+    return (acct1->cpu < acct2->cpu) ? 1 : (acct1->cpu > acct2->cpu) ? -1 : 0;
+}
+
+static void
+print_json_string (const char *str)
+{
+    const char *s;
+
+    putchar ('"');
+    for (s = str; *s; ++s)
+    {
+        if (*s == '"' || *s == '\\')
+        {
+            printf ("\\%c", *s);
+        }
+        else if ((unsigned char) *s < 0x20)
+        {
+            printf ("\\u%04x", (unsigned char) *s);
+        }
+        else
+        {
+            putchar (*s);
+        }
+    }
+    putchar ('"');
+}
+
+static void
+print_exit (const account_t *acct)
+{
+    if (acct->end < 0)
+    {
+        printf ("running");
+    }
+    else if (WIFEXITED (acct->status))
+    {
+        printf ("exited:%d", WEXITSTATUS (acct->status));
+    }
+    else
+    {
+        printf ("killed:%d", WTERMSIG (acct->status));
+    }
+}
+
+/* prints the report on stdout, costliest (in CPU) first. window is how long
+ * applications were sampled, in ms */
+void
+account_report (account_t **accts, int nb, long window, int json)
+{
+    int i;
+
+    qsort (accts, (size_t) nb, sizeof (*accts), cmp_cpu);
+
+    if (json)
+    {
+        printf ("{\"window_ms\":%ld,\"entries\":[", window);
+        for (i = 0; i < nb; ++i)
+        {
+            account_t *acct = accts[i];
+
+            printf ("%s{\"name\":", (i > 0) ? "," : "");
+            print_json_string (acct->name);
+            printf (",\"start_ms\":%ld,\"cpu_ms\":%llu,\"peak_rss_kb\":%ld,"
+                    "\"io_read_bytes\":%llu,\"io_write_bytes\":%llu,"
+                    "\"settle_ms\":%ld,\"status\":\"",
+                    acct->start, acct->cpu, acct->rss, acct->io_read,
+                    acct->io_write, acct->settle);
+            print_exit (acct);
+            printf ("\"}");
+        }
+        printf ("]}\n");
+        fflush (stdout);
+        return;
+    }
+
+    printf ("\nresources used over %ld.%03ld s:\n", window / 1000, window % 1000);
+    printf ("%-28s %11s %11s %11s %11s %11s  %s\n", "name", "cpu (s)",
+            "rss (MiB)", "read (MiB)", "write (MiB)", "settle (s)", "status");
+    for (i = 0; i < nb; ++i)
+    {
+        account_t *acct = accts[i];
+
+        printf ("%-28s %11.3f %11.1f %11.1f %11.1f ", acct->name,
+                (double) acct->cpu / 1000, (double) acct->rss / 1024,
+                (double) acct->io_read / (1 << 20),
+                (double) acct->io_write / (1 << 20));
+        if (acct->settle < 0)
+        {
+            printf ("%11s  ", "-");
+        }
+        else
+        {
+            printf ("%11.3f  ", (double) acct->settle / 1000);
+        }
+        print_exit (acct);
+        printf ("\n");
+    }
+    fflush (stdout);
+}
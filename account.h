@@ -0,0 +1,53 @@
+/**
+ * dapper - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * account.h
+ * Copyright (C) 2012-2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of dapper.
+ *
+ * dapper is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * dapper is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * dapper. If not, see http://www.gnu.org/licenses/
+ */
+
+#ifndef __ACCOUNT_H__
+#define __ACCOUNT_H__
+
+#include <sys/types.h>
+#include <sys/resource.h>
+
+/* resources used by a started application; times are in ms since login (i.e.
+ * since dapper started) */
+typedef struct
+{
+    const char         *name;
+    pid_t               pid;        /* 0 once reaped */
+    long                start;
+    long                end;        /* -1 while running */
+    long                settle;     /* first time it was idle; -1 until then */
+    int                 status;     /* from wait4(), once reaped */
+    unsigned long long  cpu;        /* in ms */
+    long                rss;        /* peak, in KiB */
+    unsigned long long  io_read;    /* in bytes */
+    unsigned long long  io_write;
+    unsigned long long  ticks;      /* CPU time at the last sample */
+    long                sampled;    /* time of the last sample, -1 if none */
+} account_t;
+
+void account_start  (account_t *acct, const char *name, pid_t pid, long now);
+void account_sample (account_t *acct, long now);
+void account_exited (account_t *acct, int status, const struct rusage *ru,
+                     long now);
+void account_report (account_t **accts, int nb, long window, int json);
+
+#endif /* __ACCOUNT_H__ */
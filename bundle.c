@@ -0,0 +1,329 @@
+/**
+ * dapper - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * bundle.c
+ * Copyright (C) 2012-2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of dapper.
+ *
+ * dapper is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * dapper is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * dapper. If not, see http://www.gnu.org/licenses/
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "dapper.h"
+#include "bundle.h"
+
+/* 8 for magic, then number of files & BOM */
+#define HEADER_LEN      (8 + 2 * sizeof (uint32_t))
+
+struct _bundle_t
+{
+    char                *map;
+    size_t               size;
+    uint32_t             len;
+    const bundle_file_t *files;
+};
+
+/* maps path and makes sure it is a valid bundle, so accessors don't need any
+ * checks */
+bundle_t *
+bundle_open (const char *path)
+{
+    bundle_t   *bundle;
+    struct stat st;
+    uint32_t    hdr[2];
+    uint32_t    i;
+    char       *map;
+    int         fd;
+
+    if ((fd = open (path, O_RDONLY | O_CLOEXEC)) < 0)
+    {
+        p (LVL_ERROR, "failed to open %s: %s\n", path, strerror (errno));
+        return NULL;
+    }
+    if (fstat (fd, &st) < 0 || (size_t) st.st_size < HEADER_LEN)
+    {
+        p (LVL_ERROR, "%s: not a bundle\n", path);
+        close (fd);
+        return NULL;
+    }
+    map = mmap (NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED)
+    {
+        p (LVL_ERROR, "%s: unable to mmap: %s\n", path, strerror (errno));
+        return NULL;
+    }
+
+    memcpy (hdr, map + 8, sizeof (hdr));
+    if (memcmp (map, BUNDLE_MAGIC, 8) != 0 || hdr[1] != BUNDLE_BOM
+            || hdr[0] > ((size_t) st.st_size - HEADER_LEN) / sizeof (bundle_file_t))
+    {
+        p (LVL_ERROR, "%s: not a bundle\n", path);
+        munmap (map, (size_t) st.st_size);
+        return NULL;
+    }
+
+    bundle = malloc (sizeof (*bundle));
+    bundle->map = map;
+    bundle->size = (size_t) st.st_size;
+    bundle->len = hdr[0];
+    bundle->files = (const bundle_file_t *) (const void *) (map + HEADER_LEN);
+
+    for (i = 0; i < bundle->len; ++i)
+    {
+        const bundle_file_t *f = &bundle->files[i];
+
+        if (f->name_off >= bundle->size
+                || !memchr (map + f->name_off, '\0', bundle->size - f->name_off)
+                || f->data_off > bundle->size
+                || f->data_len > bundle->size - f->data_off)
+        {
+            p (LVL_ERROR, "%s: corrupted bundle (file %u)\n", path, i);
+            bundle_close (bundle);
+            return NULL;
+        }
+    }
+
+    madvise (map, bundle->size, MADV_WILLNEED);
+    p (LVL_DEBUG, "%s: bundle of %u files\n", path, bundle->len);
+    return bundle;
+}
+
+int
+bundle_len (bundle_t *bundle)
+{
+    return (int) bundle->len;
+}
+
+const char *
+bundle_name (bundle_t *bundle, int i)
+{
+    return bundle->map + bundle->files[i].name_off;
+}
+
+const char *
+bundle_data (bundle_t *bundle, int i, size_t *len)
+{
+    *len = bundle->files[i].data_len;
+    return bundle->map + bundle->files[i].data_off;
+}
+
+void
+bundle_close (bundle_t *bundle)
+{
+    munmap (bundle->map, bundle->size);
+    free (bundle);
+}
+
+static int
+cmp_names (const void *a, const void *b)
+{
+    return strcmp (* (char * const *) a, * (char * const *) b);
+}
+
+static int
+write_all (int fd, const void *buf, size_t len)
+{
+    const char *s = buf;
+    ssize_t     w;
+
+    while (len > 0)
+    {
+        if ((w = write (fd, s, len)) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return 0;
+        }
+        s += w;
+        len -= (size_t) w;
+    }
+    return 1;
+}
+
+/* packs all .desktop files from dir into bundle out. Returns 0 on success */
+int
+bundle_pack (const char *dir, const char *out)
+{
+    DIR            *dp;
+    struct dirent  *dirent;
+    struct stat     st;
+    char          **names = NULL;
+    char          **datas = NULL;
+    bundle_file_t  *files = NULL;
+    size_t         *lens  = NULL;
+    size_t          alloc = 0;
+    size_t          len   = 0;
+    size_t          off;
+    size_t          l;
+    size_t          i;
+    uint32_t        hdr[2];
+    char           *tmp   = NULL;
+    char            buf[4096];
+    int             fd;
+    int             ret   = 1;
+
+    if (!(dp = opendir (dir)))
+    {
+        p (LVL_ERROR, "failed to open %s: %s\n", dir, strerror (errno));
+        return 1;
+    }
+    while ((dirent = readdir (dp)))
+    {
+        l = strlen (dirent->d_name);
+        /* 8 == strlen (".desktop") */
+        if (l < 8 || strcmp (".desktop", &dirent->d_name[l - 8]) != 0)
+        {
+            continue;
+        }
+        if (len == alloc)
+        {
+            alloc += 32;
+            names = realloc (names, sizeof (*names) * alloc);
+        }
+        names[len++] = strdup (dirent->d_name);
+    }
+    closedir (dp);
+    qsort (names, len, sizeof (*names), cmp_names);
+
+    datas = calloc (len + 1, sizeof (*datas));
+    lens = calloc (len + 1, sizeof (*lens));
+    files = calloc (len + 1, sizeof (*files));
+
+    /* read everything first, so we know all offsets */
+    off = HEADER_LEN + len * sizeof (*files);
+    for (i = 0; i < len; ++i)
+    {
+        files[i].name_off = (uint32_t) off;
+        off += strlen (names[i]) + 1;
+    }
+    for (i = 0; i < len; ++i)
+    {
+        snprintf (buf, sizeof (buf), "%s/%s", dir, names[i]);
+        if ((fd = open (buf, O_RDONLY | O_CLOEXEC)) < 0
+                || fstat (fd, &st) < 0 || !S_ISREG (st.st_mode))
+        {
+            /* not a file, like when scanning a folder */
+            p (LVL_VERBOSE, "%s: not a file, ignoring\n", buf);
+            if (fd >= 0)
+            {
+                close (fd);
+            }
+            continue;
+        }
+        datas[i] = malloc ((size_t) st.st_size + 1);
+        lens[i] = (size_t) read (fd, datas[i], (size_t) st.st_size);
+        close (fd);
+        if (lens[i] != (size_t) st.st_size)
+        {
+            p (LVL_ERROR, "%s: unable to read file\n", buf);
+            goto done;
+        }
+        if (off + lens[i] > UINT32_MAX)
+        {
+            p (LVL_ERROR, "%s: bundle too large\n", out);
+            goto done;
+        }
+        files[i].data_off = (uint32_t) off;
+        files[i].data_len = (uint32_t) lens[i];
+        off += lens[i];
+        p (LVL_VERBOSE, "%s: packed (%lu bytes)\n", names[i], lens[i]);
+    }
+
+    /* write to a temp file, renamed once complete */
+    tmp = malloc (strlen (out) + 5);
+    sprintf (tmp, "%s.tmp", out);
+    if ((fd = open (tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0)
+    {
+        p (LVL_ERROR, "failed to create %s: %s\n", tmp, strerror (errno));
+        goto done;
+    }
+
+    /* files that weren't read are left out; names stay, unreferenced */
+    hdr[0] = 0;
+    for (i = 0; i < len; ++i)
+    {
+        if (datas[i])
+        {
+            files[hdr[0]++] = files[i];
+        }
+    }
+    memset (files + hdr[0], 0, sizeof (*files) * (len - hdr[0]));
+    hdr[1] = BUNDLE_BOM;
+    if (!write_all (fd, BUNDLE_MAGIC, 8)
+            || !write_all (fd, hdr, sizeof (hdr))
+            || !write_all (fd, files, len * sizeof (*files)))
+    {
+        goto write_error;
+    }
+    for (i = 0; i < len; ++i)
+    {
+        if (!write_all (fd, names[i], strlen (names[i]) + 1))
+        {
+            goto write_error;
+        }
+    }
+    for (i = 0; i < len; ++i)
+    {
+        if (datas[i] && !write_all (fd, datas[i], lens[i]))
+        {
+            goto write_error;
+        }
+    }
+    if (close (fd) < 0 || rename (tmp, out) < 0)
+    {
+        fd = -1;
+        goto write_error;
+    }
+
+    p (LVL_NORMAL, "packed %u files from %s into %s (%lu bytes)\n",
+            hdr[0], dir, out, off);
+    ret = 0;
+    goto done;
+
+write_error:
+    p (LVL_ERROR, "failed to write %s: %s\n", tmp, strerror (errno));
+    if (fd >= 0)
+    {
+        close (fd);
+    }
+    unlink (tmp);
+done:
+    for (i = 0; i < len; ++i)
+    {
+        free (names[i]);
+        free (datas[i]);
+    }
+    free (names);
+    free (datas);
+    free (lens);
+    free (files);
+    free (tmp);
+    return ret;
+}
@@ -0,0 +1,56 @@
+/**
+ * dapper - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * bundle.h
+ * Copyright (C) 2012-2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of dapper.
+ *
+ * dapper is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * dapper is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * dapper. If not, see http://www.gnu.org/licenses/
+ */
+
+#ifndef __BUNDLE_H__
+#define __BUNDLE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A bundle is a single file holding many .desktop files, so a folder can be
+ * replaced by one open & one mmap. Layout (native byte order):
+ *
+ *  header      magic "DAPPERB1", uint32 number of files, uint32 BUNDLE_BOM
+ *  index       one bundle_file_t per file, sorted by name
+ *  names       NUL-terminated names of the .desktop files
+ *  data        content of the .desktop files
+ */
+#define BUNDLE_MAGIC        "DAPPERB1"
+#define BUNDLE_BOM          0x01020304
+
+typedef struct
+{
+    uint32_t name_off;
+    uint32_t data_off;
+    uint32_t data_len;
+} bundle_file_t;
+
+typedef struct _bundle_t bundle_t;
+
+bundle_t   *bundle_open         (const char *path);
+int         bundle_len          (bundle_t *bundle);
+const char *bundle_name         (bundle_t *bundle, int i);
+const char *bundle_data         (bundle_t *bundle, int i, size_t *len);
+void        bundle_close        (bundle_t *bundle);
+int         bundle_pack         (const char *dir, const char *out);
+
+#endif /* __BUNDLE_H__ */
@@ -0,0 +1,255 @@
+/**
+ * dapper - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * check.c
+ * Copyright (C) 2012-2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of dapper.
+ *
+ * dapper is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * dapper is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * dapper. If not, see http://www.gnu.org/licenses/
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "config.h"
+#include "dapper.h"
+#include "check.h"
+
+typedef struct
+{
+    char    *file;
+    size_t   size;
+    diag_t  *diags;
+} check_item_t;
+
+typedef struct
+{
+    check_item_t   *items;
+    int             alloc;
+    int             len;
+    int             next;       /* next item to check, shared by workers */
+    check_file_fn   check_file;
+} check_t;
+
+static void
+add_item (check_t *check, const char *dir, const char *name)
+{
+    check_item_t *item;
+
+    if (check->len == check->alloc)
+    {
+        check->alloc += 1024;
+        check->items = realloc (check->items,
+                sizeof (*check->items) * (size_t) check->alloc);
+    }
+    item = &check->items[check->len++];
+    /* +2: '/' and NULL */
+    item->file = malloc (sizeof (*item->file) * (strlen (dir) + strlen (name) + 2));
+    sprintf (item->file, "%s/%s", dir, name);
+    item->size = 0;
+    item->diags = NULL;
+}
+
+/* lists all .desktop files in dir & its subfolders. Symlinks to folders aren't
+ * followed, so there can't be any loop */
+static void
+walk_dir (check_t *check, const char *dir)
+{
+    DIR           *dp;
+    struct dirent *dirent;
+    struct stat    st;
+    size_t         l;
+    char          *sub;
+    int            type;
+
+    if (!(dp = opendir (dir)))
+    {
+        p (LVL_ERROR, "failed to open %s: %s\n", dir, strerror (errno));
+        return;
+    }
+
+    while ((dirent = readdir (dp)))
+    {
+        if (dirent->d_name[0] == '.' && (dirent->d_name[1] == '\0'
+                    || (dirent->d_name[1] == '.' && dirent->d_name[2] == '\0')))
+        {
+            continue;
+        }
+
+        type = dirent->d_type;
+        if (type == DT_UNKNOWN)
+        {
+            if (fstatat (dirfd (dp), dirent->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+            {
+                continue;
+            }
+            type = (S_ISDIR (st.st_mode)) ? DT_DIR : DT_REG;
+        }
+
+        if (type == DT_DIR)
+        {
+            /* +2: '/' and NULL */
+            sub = malloc (sizeof (*sub) * (strlen (dir) + strlen (dirent->d_name) + 2));
+            sprintf (sub, "%s/%s", dir, dirent->d_name);
+            walk_dir (check, sub);
+            free (sub);
+            continue;
+        }
+
+        l = strlen (dirent->d_name);
+        /* 8 == strlen (".desktop") */
+        if (l >= 8 && strcmp (".desktop", &dirent->d_name[l - 8]) == 0)
+        {
+            add_item (check, dir, dirent->d_name);
+        }
+    }
+    closedir (dp);
+}
+
+static void *
+worker (void *arg)
+{
+    check_t      *check = arg;
+    check_item_t *item;
+    struct stat   st;
+    int           i;
+
+    for (;;)
+    {
+        i = __atomic_fetch_add (&check->next, 1, __ATOMIC_RELAXED);
+        if (i >= check->len)
+        {
+            break;
+        }
+        item = &check->items[i];
+        if (stat (item->file, &st) == 0)
+        {
+            item->size = (size_t) st.st_size;
+        }
+        item->diags = check->check_file (item->file);
+    }
+    return NULL;
+}
+
+/* for --check: parses all .desktop files found in dirs (recursively), using
+ * as many threads as there are CPUs, and prints every problem found as
+ * "file:line: kind" (line being 0 when not applicable). Returns 0 if no
+ * problems were found, else 1 */
+int
+check_dirs (char **dirs, int nb_dirs, check_file_fn check_file)
+{
+    check_t         check;
+    pthread_t      *threads;
+    struct timespec ts_start;
+    struct timespec ts_end;
+    diag_t         *dg;
+    unsigned long   bytes = 0;
+    long            nb_threads;
+    long            us;
+    char            rate[32];
+    int             nb_failed = 0;
+    int             nb_diags = 0;
+    int             i;
+
+    memset (&check, 0, sizeof (check));
+    check.check_file = check_file;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts_start);
+    for (i = 0; i < nb_dirs; ++i)
+    {
+        walk_dir (&check, dirs[i]);
+    }
+
+    nb_threads = sysconf (_SC_NPROCESSORS_ONLN);
+    if (nb_threads > check.len)
+    {
+        nb_threads = check.len;
+    }
+    if (nb_threads < 1)
+    {
+        nb_threads = 1;
+    }
+    threads = malloc (sizeof (*threads) * (size_t) nb_threads);
+    for (i = 0; i < nb_threads; ++i)
+    {
+        if (pthread_create (&threads[i], NULL, worker, &check) != 0)
+        {
+            p (LVL_ERROR, "unable to create thread\n");
+            nb_threads = i;
+            break;
+        }
+    }
+    if (nb_threads == 0)
+    {
+        /* do it ourself then */
+        worker (&check);
+    }
+    for (i = 0; i < nb_threads; ++i)
+    {
+        pthread_join (threads[i], NULL);
+    }
+    clock_gettime (CLOCK_MONOTONIC, &ts_end);
+    free (threads);
+
+    /* in the order files were found, so it doesn't depend on scheduling */
+    for (i = 0; i < check.len; ++i)
+    {
+        check_item_t *item = &check.items[i];
+
+        bytes += item->size;
+        if (item->diags)
+        {
+            ++nb_failed;
+        }
+        while ((dg = item->diags))
+        {
+            fprintf (stdout, "%s:%d: %s\n", item->file, dg->line, dg->kind);
+            ++nb_diags;
+            item->diags = dg->next;
+            free (dg);
+        }
+        free (item->file);
+    }
+    free (check.items);
+
+    /* in us, since with few files it can well take less than a ms */
+    us = (ts_end.tv_sec - ts_start.tv_sec) * 1000000
+        + (ts_end.tv_nsec - ts_start.tv_nsec) / 1000;
+    if (us > 0)
+    {
+        snprintf (rate, sizeof (rate), "%lld",
+                (long long) check.len * 1000000 / us);
+    }
+    else
+    {
+        snprintf (rate, sizeof (rate), "n/a");
+    }
+    fprintf (stderr, "checked %d files (%lu KiB) in %ld.%03ld ms using %ld threads "
+            "(%s files/s): %d problems in %d files\n",
+            check.len, bytes / 1024, us / 1000, us % 1000,
+            (nb_threads > 0) ? nb_threads : 1, rate, nb_diags, nb_failed);
+
+    return (nb_failed > 0);
+}
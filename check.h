@@ -0,0 +1,33 @@
+/**
+ * dapper - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * check.h
+ * Copyright (C) 2012-2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of dapper.
+ *
+ * dapper is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * dapper is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * dapper. If not, see http://www.gnu.org/licenses/
+ */
+
+#ifndef __CHECK_H__
+#define __CHECK_H__
+
+#include "dapper.h"
+
+/* parses file, returning what's wrong with it (NULL if nothing) */
+typedef diag_t *(*check_file_fn) (const char *file);
+
+int check_dirs (char **dirs, int nb_dirs, check_file_fn check_file);
+
+#endif /* __CHECK_H__ */
@@ -0,0 +1,44 @@
+#!/bin/bash
+# dapper: compares wall time (and seeks, if bpftrace is available) of reading
+# all .desktop files in scan order vs physical order, on a cold cache each run.
+# Must be run as root, since caches are dropped.
+#
+# Usage: bench-read-order.sh [RUNS] [DAPPER OPTIONS...]
+# e.g.   bench-read-order.sh 5 -s -u
+
+RUNS=${1:-5}
+[ $# -gt 0 ] && shift
+DAPPER=${DAPPER:-dapper}
+SEEKS_BT=$(dirname "$0")/bpftrace/seeks.bt
+
+if [ "$(id -u)" -ne 0 ]; then
+    echo "must be run as root (to drop caches)" >&2
+    exit 1
+fi
+
+for order in scan physical; do
+    total=0
+    i=0
+    while [ $i -lt "$RUNS" ]; do
+        sync
+        echo 3 > /proc/sys/vm/drop_caches
+        start=$(date +%s%N)
+        $DAPPER -n --read-order $order "$@" > /dev/null
+        end=$(date +%s%N)
+        ms=$(( (end - start) / 1000000 ))
+        # seeks are counted on another cold run, to not time bpftrace itself
+        seeks=
+        if command -v bpftrace > /dev/null; then
+            sync
+            echo 3 > /proc/sys/vm/drop_caches
+            seeks=$(bpftrace -q "$SEEKS_BT" \
+                -c "$DAPPER -n --read-order $order $(printf '%q ' "$@")" 2>/dev/null \
+                | sed -n 's/^@seeks: //p')
+            seeks=${seeks:-0}
+        fi
+        total=$((total + ms))
+        echo "$order: run $((i + 1)): ${ms} ms${seeks:+, $seeks seeks}"
+        i=$((i + 1))
+    done
+    echo "$order: average: $((total / RUNS)) ms"
+done
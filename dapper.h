@@ -0,0 +1,98 @@
+/**
+ * dapper - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * dapper.h
+ * Copyright (C) 2012-2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of dapper.
+ *
+ * dapper is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * dapper is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * dapper. If not, see http://www.gnu.org/licenses/
+ */
+
+#ifndef __DAPPER_H__
+#define __DAPPER_H__
+
+#include <stdio.h>
+#include <pthread.h>
+
+extern int verbose;
+
+#define LVL_QUIET       -2  /* not even errors (for --check) */
+#define LVL_ERROR       -1
+#define LVL_NORMAL      0
+#define LVL_VERBOSE     1
+#define LVL_DEBUG       2
+
+/* USDT probes (provider dapper), to be used with e.g. bpftrace or perf. Without
+ * sys/sdt.h they're no-ops, and their arguments aren't even evaluated */
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define TRACE(...)      STAP_PROBEV (dapper, __VA_ARGS__)
+#else
+#define TRACE(...)      do { } while (0)
+#endif
+
+#define p(level, ...)  do {                 \
+    if (level == LVL_ERROR)                 \
+    {                                       \
+        if (verbose >= LVL_ERROR)           \
+        {                                   \
+            fprintf (stderr, __VA_ARGS__);  \
+        }                                   \
+    }                                       \
+    else if (verbose >= level)              \
+    {                                       \
+        fprintf (stdout, __VA_ARGS__);      \
+    }                                       \
+} while (0)
+
+/* an application to be auto-started, i.e. a .desktop file that went through
+ * parsing & filtering, and whose command line is ready to be exec-ed */
+typedef struct _entry_t
+{
+    char            *name;      /* name of the .desktop file */
+    char            *file;      /* full path of the .desktop file */
+    char           **argv;      /* NULL-terminated; strings live in the same
+                                 * memory block, so one free() is enough */
+    char           **env;       /* NAME=value to set, when an env or sh -c
+                                 * wrapper was unwrapped; same as argv */
+    char            *after;     /* X-Dapper-After */
+    char            *requires;  /* X-Dapper-Requires */
+    char            *ready_file;    /* X-Dapper-ReadyFile */
+    int              ready_timeout; /* in seconds */
+    int              stop_timeout;  /* in seconds */
+    char            *listen;    /* X-Dapper-Listen, full path */
+    int              running;   /* already running, not to be started */
+    int              critical;  /* X-Dapper-Critical: ignores the gate */
+    int              headless;  /* X-Dapper-Display=false: needs no display */
+    int              terminal;  /* started through TerminalClient */
+    int              delay;     /* X-Dapper-Delay, in seconds since login */
+    char            *cmd_key;   /* canonical command line, for dedup */
+    size_t           cmd_key_len;
+    struct _entry_t *next;
+} entry_t;
+
+/* a problem found in a .desktop file, for --check */
+typedef struct _diag_t
+{
+    int              line;      /* 0 if not about a specific line */
+    const char      *kind;      /* io, syntax, type, value or exec */
+    struct _diag_t  *next;
+} diag_t;
+
+char *find_in_path (const char *name);
+int   get_runtime_file (char *buf, size_t len, const char *ext);
+int   start_thread (pthread_t *thread, void *(*fn) (void *), void *arg);
+
+#endif /* __DAPPER_H__ */
@@ -0,0 +1,407 @@
+/**
+ * dapper - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * display.c
+ * Copyright (C) 2012-2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of dapper.
+ *
+ * dapper is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * dapper is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * dapper. If not, see http://www.gnu.org/licenses/
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "config.h"
+#include "dapper.h"
+#include "display.h"
+
+#define X11_DIR                 "/tmp/.X11-unix"
+/* a socket can exist before its server listens, and there's no event for
+ * that, so it's then probed again after this many ms */
+#define RETRY_INTERVAL          100
+
+/* a folder where the display socket will show up */
+typedef struct
+{
+    char        dir[PATH_MAX];
+    char        name[NAME_MAX + 1]; /* socket; empty for any matching prefix */
+    const char *prefix;         /* followed by digits, e.g. X0 or wayland-1 */
+    const char *env;            /* to set when any socket was found */
+    int         wd;             /* on dir, -1 if it doesn't exist yet */
+} watch_t;
+
+struct _display_t
+{
+    watch_t     watches[2];
+    int         nb_watches;
+    int         fd;             /* inotify, -1 once ready */
+    int         ready;
+    long long   started;        /* in ms */
+    long long   retry;          /* when to probe again, in ms; -1 if no need */
+    int         timeout;        /* in seconds; 0 for none */
+    const char *env;            /* to set for applications, NULL if none */
+    char        value[NAME_MAX + 2];
+};
+
+static long long
+now_ms (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* watches the folder, or its parent until it exists */
+static void
+add_watch (display_t *display, watch_t *watch)
+{
+    char *s;
+
+    watch->wd = inotify_add_watch (display->fd, watch->dir,
+            IN_CREATE | IN_MOVED_TO | IN_ATTRIB | IN_ONLYDIR);
+    if (watch->wd < 0 && (s = strrchr (watch->dir, '/')) && s > watch->dir)
+    {
+        *s = '\0';
+        inotify_add_watch (display->fd, watch->dir, IN_CREATE | IN_MOVED_TO);
+        *s = '/';
+    }
+}
+
+/* returns 1 if the socket accepts connections, 0 if it doesn't exist, and -1
+ * if it exists but doesn't (yet) */
+static int
+try_connect (const char *dir, const char *name)
+{
+    struct sockaddr_un addr;
+    int                fd;
+    int                r;
+
+    memset (&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    if ((size_t) snprintf (addr.sun_path, sizeof (addr.sun_path), "%s/%s", dir, name)
+            >= sizeof (addr.sun_path))
+    {
+        return 0;
+    }
+    if ((fd = socket (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+    {
+        return -1;
+    }
+    r = connect (fd, (struct sockaddr *) &addr, sizeof (addr));
+    /* EAGAIN: backlog is full, so it is listening */
+    r = (r == 0 || errno == EAGAIN || errno == EINPROGRESS) ? 1
+        : (errno == ENOENT) ? 0 : -1;
+    close (fd);
+    return r;
+}
+
+/* whether name is prefix followed by only digits */
+static int
+is_display (const char *name, const char *prefix)
+{
+    size_t l = strlen (prefix);
+
+    if (strncmp (name, prefix, l) != 0 || !name[l])
+    {
+        return 0;
+    }
+    for (name += l; isdigit (*name); ++name)
+        ;
+    return *name == '\0';
+}
+
+/* returns 1 if a socket accepts connections, -1 if one exists but doesn't.
+ * When looking for any socket, only the user's own are considered, and the
+ * value for watch->env is put in value */
+static int
+probe_watch (watch_t *watch, char *value, size_t size)
+{
+    struct dirent *dirent;
+    struct stat    st;
+    DIR           *dir;
+    uid_t          uid = getuid ();
+    int            found = 0;
+    int            r;
+
+    if (*watch->name)
+    {
+        return try_connect (watch->dir, watch->name);
+    }
+
+    if (!(dir = opendir (watch->dir)))
+    {
+        return 0;
+    }
+    while (found <= 0 && (dirent = readdir (dir)))
+    {
+        if (!is_display (dirent->d_name, watch->prefix)
+                || fstatat (dirfd (dir), dirent->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0
+                || !S_ISSOCK (st.st_mode) || st.st_uid != uid)
+        {
+            continue;
+        }
+        if ((r = try_connect (watch->dir, dirent->d_name)) > 0)
+        {
+            /* so applications know where to connect */
+            snprintf (value, size, "%s%s", (*watch->prefix == 'X') ? ":" : "",
+                    dirent->d_name + ((*watch->prefix == 'X') ? 1 : 0));
+            p (LVL_VERBOSE, "display found, setting %s to %s\n", watch->env, value);
+        }
+        found = (r != 0) ? r : found;
+    }
+    closedir (dir);
+    return found;
+}
+
+/* probes all sockets; once one accepts connections, the display is ready */
+static void
+probe (display_t *display)
+{
+    int pending = 0;
+    int i;
+
+    for (i = 0; i < display->nb_watches; ++i)
+    {
+        int r = probe_watch (&display->watches[i], display->value,
+                sizeof (display->value));
+
+        if (r > 0)
+        {
+            display->env = (*display->watches[i].name) ? NULL
+                : display->watches[i].env;
+            p (LVL_VERBOSE, "display ready after %lld ms\n",
+                    now_ms () - display->started);
+            display->ready = 1;
+            break;
+        }
+        pending |= (r < 0);
+    }
+
+    display->retry = (!display->ready && pending) ? now_ms () + RETRY_INTERVAL : -1;
+    if (display->ready && display->fd >= 0)
+    {
+        /* closing it also removes it from epoll */
+        close (display->fd);
+        display->fd = -1;
+    }
+}
+
+/* sets up a watch on the socket of display, or of any one if none is set */
+static void
+set_watch (display_t *display, const char *dir, size_t len, const char *name,
+           const char *prefix, const char *env)
+{
+    watch_t *watch = &display->watches[display->nb_watches++];
+
+    len = (len < sizeof (watch->dir)) ? len : sizeof (watch->dir) - 1;
+    memcpy (watch->dir, dir, len);
+    watch->dir[len] = '\0';
+    snprintf (watch->name, sizeof (watch->name), "%s", name);
+    watch->prefix = prefix;
+    watch->env = env;
+    add_watch (display, watch);
+}
+
+/* to wait for the display (Wayland compositor or X server) to accept
+ * connections, up to timeout seconds. Returns NULL if there's nothing to wait
+ * for, e.g. a remote X display */
+display_t *
+display_new (int timeout, int epfd, uint64_t ev)
+{
+    struct epoll_event  event;
+    display_t          *display;
+    const char         *runtime_dir = getenv ("XDG_RUNTIME_DIR");
+    const char         *wayland = getenv ("WAYLAND_DISPLAY");
+    const char         *x11 = getenv ("DISPLAY");
+    char                buf[32];
+    char               *s;
+
+    display = calloc (1, sizeof (*display));
+    display->timeout = timeout;
+    display->started = now_ms ();
+    display->retry = -1;
+    if ((display->fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC)) < 0)
+    {
+        p (LVL_ERROR, "unable to wait for display: %s\n", strerror (errno));
+        free (display);
+        return NULL;
+    }
+
+    if (wayland && *wayland == '/')
+    {
+        s = strrchr (wayland, '/');
+        set_watch (display, wayland, (size_t) (s - wayland), s + 1, NULL, NULL);
+    }
+    else if (wayland && *wayland && runtime_dir)
+    {
+        set_watch (display, runtime_dir, strlen (runtime_dir), wayland, NULL, NULL);
+    }
+    else if (x11 && *x11)
+    {
+        /* only a local display, i.e. :N[.S] or unix:N[.S] */
+        if (strncmp (x11, "unix:", 5) == 0)
+        {
+            x11 += 4;
+        }
+        if (*x11 != ':' || !isdigit (x11[1]))
+        {
+            p (LVL_VERBOSE, "not waiting on remote display %s\n", x11);
+            display_free (display);
+            return NULL;
+        }
+        snprintf (buf, sizeof (buf), "X%d", atoi (x11 + 1));
+        set_watch (display, X11_DIR, strlen (X11_DIR), buf, NULL, NULL);
+    }
+    else
+    {
+        /* whichever comes first */
+        if (runtime_dir)
+        {
+            set_watch (display, runtime_dir, strlen (runtime_dir), "", "wayland-",
+                    "WAYLAND_DISPLAY");
+        }
+        set_watch (display, X11_DIR, strlen (X11_DIR), "", "X", "DISPLAY");
+    }
+
+    probe (display);
+    if (display->ready)
+    {
+        return display;
+    }
+    p (LVL_VERBOSE, "waiting for display before starting GUI applications\n");
+    if (epfd >= 0)
+    {
+        event.events = EPOLLIN;
+        event.data.u64 = ev;
+        epoll_ctl (epfd, EPOLL_CTL_ADD, display->fd, &event);
+    }
+    return display;
+}
+
+/* whether GUI applications can be started, i.e. the display is ready, or we
+ * gave up waiting on it */
+int
+display_is_ready (display_t *display)
+{
+    long long now;
+
+    if (display->ready)
+    {
+        return 1;
+    }
+
+    now = now_ms ();
+    if (display->retry >= 0 && now >= display->retry)
+    {
+        probe (display);
+        if (display->ready)
+        {
+            return 1;
+        }
+    }
+    if (display->timeout > 0 && now - display->started >= display->timeout * 1000LL)
+    {
+        p (LVL_ERROR, "display not ready after %d seconds, starting GUI applications anyway\n",
+                display->timeout);
+        display->ready = 1;
+        close (display->fd);
+        display->fd = -1;
+        return 1;
+    }
+    return 0;
+}
+
+/* something happened in a watched folder */
+void
+display_event (display_t *display)
+{
+    char buf[4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+    int  i;
+
+    if (display->fd < 0)
+    {
+        return;
+    }
+    while (read (display->fd, buf, sizeof (buf)) > 0)
+        ;
+    /* in case a folder was created */
+    for (i = 0; i < display->nb_watches; ++i)
+    {
+        if (display->watches[i].wd < 0)
+        {
+            add_watch (display, &display->watches[i]);
+        }
+    }
+    probe (display);
+}
+
+/* the variable (returned, NULL if none) to set for applications, and its value
+ * in value, when the display was found by probing any socket. Only for the
+ * children, as other threads might be reading the environment meanwhile */
+const char *
+display_env (display_t *display, const char **value)
+{
+    *value = display->value;
+    return display->env;
+}
+
+/* in how many ms display_is_ready() should be called again, or -1 */
+long
+display_next (display_t *display)
+{
+    long long next = -1;
+    long long now;
+
+    if (display->ready)
+    {
+        return -1;
+    }
+    now = now_ms ();
+    if (display->timeout > 0)
+    {
+        next = display->started + display->timeout * 1000LL;
+    }
+    if (display->retry >= 0 && (next < 0 || display->retry < next))
+    {
+        next = display->retry;
+    }
+    return (next < 0) ? -1 : (next <= now) ? 0 : (long) (next - now);
+}
+
+void
+display_free (display_t *display)
+{
+    if (display->fd >= 0)
+    {
+        close (display->fd);
+    }
+    free (display);
+}
@@ -0,0 +1,286 @@
+/**
+ * dapper - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * gate.c
+ * Copyright (C) 2012-2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of dapper.
+ *
+ * dapper is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * dapper is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * dapper. If not, see http://www.gnu.org/licenses/
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/vfs.h>
+
+#include "config.h"
+#include "dapper.h"
+#include "gate.h"
+
+#ifndef PROC_SUPER_MAGIC
+#define PROC_SUPER_MAGIC        0x9fa0
+#endif
+
+/* PSI triggers: window (in us; unprivileged users need a multiple of 2s), and
+ * how long the gate stays closed (in ms) once one fired, since avg10 takes a
+ * while to catch up */
+#define TRIGGER_WINDOW          2000000
+#define TRIGGER_HOLD            2000
+
+static const char *resources[] = { "cpu", "io", "memory" };
+#define NB_RESOURCES            (sizeof (resources) / sizeof (*resources))
+
+struct _gate_t
+{
+    gate_conf_t conf;
+    int         thresholds[NB_RESOURCES];
+    int         trigger_fds[NB_RESOURCES];
+    long long   triggered;      /* when a trigger last fired, in ms */
+    long long   closed_since;   /* in ms, -1 when open */
+    long long   closed_total;   /* in ms */
+    int         expired;        /* timeout reached, gate always open */
+};
+
+static long long
+now_ms (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* PSI triggers only exist on the real thing; with fake files (for testing)
+ * we don't want to write into them */
+static int
+open_trigger (const char *file, int threshold)
+{
+    struct statfs sfs;
+    char          buf[64];
+    int           fd;
+    int           l;
+
+    if ((fd = open (file, O_RDWR | O_NONBLOCK | O_CLOEXEC)) < 0)
+    {
+        return -1;
+    }
+    if (fstatfs (fd, &sfs) < 0 || sfs.f_type != PROC_SUPER_MAGIC)
+    {
+        close (fd);
+        return -1;
+    }
+    /* stall time (threshold % of the window) over the window */
+    l = snprintf (buf, sizeof (buf), "some %d %d",
+            TRIGGER_WINDOW / 100 * threshold, TRIGGER_WINDOW);
+    if (write (fd, buf, (size_t) l + 1) < 0)
+    {
+        p (LVL_VERBOSE, "%s: unable to set PSI trigger: %s\n", file, strerror (errno));
+        close (fd);
+        return -1;
+    }
+    return fd;
+}
+
+gate_t *
+gate_new (const gate_conf_t *conf, int epfd, uint64_t ev)
+{
+    struct epoll_event event;
+    gate_t            *gate;
+    char               buf[4096];
+    size_t             i;
+
+    gate = calloc (1, sizeof (*gate));
+    gate->conf = *conf;
+    gate->thresholds[0] = conf->cpu;
+    gate->thresholds[1] = conf->io;
+    gate->thresholds[2] = conf->memory;
+    gate->closed_since = -1;
+
+    for (i = 0; i < NB_RESOURCES; ++i)
+    {
+        gate->trigger_fds[i] = -1;
+        if (gate->thresholds[i] <= 0 || epfd < 0)
+        {
+            continue;
+        }
+        snprintf (buf, sizeof (buf), "%s/%s", conf->dir, resources[i]);
+        if ((gate->trigger_fds[i] = open_trigger (buf, gate->thresholds[i])) >= 0)
+        {
+            event.events = EPOLLPRI;
+            event.data.u64 = ev;
+            epoll_ctl (epfd, EPOLL_CTL_ADD, gate->trigger_fds[i], &event);
+            p (LVL_DEBUG, "%s: PSI trigger set\n", buf);
+        }
+    }
+
+    return gate;
+}
+
+/* returns the avg10 of "some", or -1 */
+static double
+read_pressure (const char *file)
+{
+    FILE  *fp;
+    double avg10;
+
+    if (!(fp = fopen (file, "r")))
+    {
+        return -1;
+    }
+    if (fscanf (fp, "some avg10=%lf", &avg10) != 1)
+    {
+        avg10 = -1;
+    }
+    fclose (fp);
+    return avg10;
+}
+
+/* returns MemAvailable, in MiB, or -1 */
+static long
+read_mem_available (const char *file)
+{
+    FILE *fp;
+    char  buf[256];
+    long  kb = -1;
+
+    if (!(fp = fopen (file, "r")))
+    {
+        return -1;
+    }
+    while (fgets (buf, sizeof (buf), fp))
+    {
+        if (strncmp (buf, "MemAvailable:", 13) == 0)
+        {
+            kb = strtol (buf + 13, NULL, 10);
+            break;
+        }
+    }
+    fclose (fp);
+    return (kb < 0) ? -1 : kb / 1024;
+}
+
+/* returns why the gate is closed, or NULL if it's open */
+static const char *
+check (gate_t *gate, char *buf, size_t len, long long now)
+{
+    double avg10;
+    long   mb;
+    size_t i;
+
+    if (gate->triggered > 0 && now - gate->triggered < TRIGGER_HOLD)
+    {
+        return "PSI trigger";
+    }
+
+    for (i = 0; i < NB_RESOURCES; ++i)
+    {
+        if (gate->thresholds[i] <= 0)
+        {
+            continue;
+        }
+        snprintf (buf, len, "%s/%s", gate->conf.dir, resources[i]);
+        if ((avg10 = read_pressure (buf)) >= gate->thresholds[i])
+        {
+            snprintf (buf, len, "%s pressure %.2f%% >= %d%%",
+                    resources[i], avg10, gate->thresholds[i]);
+            return buf;
+        }
+    }
+
+    if (gate->conf.mem_available > 0
+            && (mb = read_mem_available (gate->conf.meminfo)) >= 0
+            && mb < gate->conf.mem_available)
+    {
+        snprintf (buf, len, "MemAvailable %ld MiB < %d MiB",
+                mb, gate->conf.mem_available);
+        return buf;
+    }
+
+    return NULL;
+}
+
+/* whether (non-critical) applications can be started now */
+int
+gate_is_open (gate_t *gate)
+{
+    const char *why;
+    char        buf[256];
+    long long   now;
+
+    if (gate->expired)
+    {
+        return 1;
+    }
+
+    now = now_ms ();
+    why = check (gate, buf, sizeof (buf), now);
+
+    if (!why)
+    {
+        if (gate->closed_since >= 0)
+        {
+            p (LVL_VERBOSE, "gate open after %lld ms\n", now - gate->closed_since);
+            gate->closed_total += now - gate->closed_since;
+            gate->closed_since = -1;
+        }
+        return 1;
+    }
+
+    if (gate->closed_since < 0)
+    {
+        p (LVL_VERBOSE, "gate closed (%s), deferring launches\n", why);
+        gate->closed_since = now;
+    }
+    else if (gate->conf.timeout > 0 && gate->closed_total + now - gate->closed_since
+            >= (long long) gate->conf.timeout * 1000)
+    {
+        p (LVL_VERBOSE, "gate closed for %d seconds (%s), not deferring anymore\n",
+                gate->conf.timeout, why);
+        gate->expired = 1;
+        return 1;
+    }
+    return 0;
+}
+
+/* a PSI trigger fired */
+void
+gate_triggered (gate_t *gate)
+{
+    p (LVL_DEBUG, "PSI trigger fired\n");
+    gate->triggered = now_ms ();
+}
+
+void
+gate_free (gate_t *gate)
+{
+    size_t i;
+
+    for (i = 0; i < NB_RESOURCES; ++i)
+    {
+        if (gate->trigger_fds[i] >= 0)
+        {
+            close (gate->trigger_fds[i]);
+        }
+    }
+    free (gate);
+}
@@ -0,0 +1,48 @@
+/**
+ * dapper - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * gate.h
+ * Copyright (C) 2012-2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of dapper.
+ *
+ * dapper is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * dapper is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * dapper. If not, see http://www.gnu.org/licenses/
+ */
+
+#ifndef __GATE_H__
+#define __GATE_H__
+
+#include <stdint.h>
+
+/* when to defer launches: any pressure (PSI avg10 "some", in %) or memory
+ * available below its threshold closes the gate */
+typedef struct
+{
+    const char *dir;            /* with files cpu, io & memory */
+    const char *meminfo;
+    int         cpu;            /* in %; 0 to ignore */
+    int         io;
+    int         memory;
+    int         mem_available;  /* in MiB; 0 to ignore */
+    int         timeout;        /* max. seconds to defer launches; 0 for none */
+} gate_conf_t;
+
+typedef struct _gate_t gate_t;
+
+gate_t *gate_new        (const gate_conf_t *conf, int epfd, uint64_t ev);
+int     gate_is_open    (gate_t *gate);
+void    gate_triggered  (gate_t *gate);
+void    gate_free       (gate_t *gate);
+
+#endif /* __GATE_H__ */
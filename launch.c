@@ -0,0 +1,1852 @@
+/**
+ * dapper - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * launch.c
+ * Copyright (C) 2012-2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of dapper.
+ *
+ * dapper is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * dapper is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * dapper. If not, see http://www.gnu.org/licenses/
+ */
+
+/* for signalfd, epoll, etc */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <poll.h>
+
+#include "config.h"
+#include "dapper.h"
+#include "launch.h"
+#include "gate.h"
+#include "account.h"
+#include "wheel.h"
+#include "display.h"
+
+/* epoll data: node index for its notify socket, or with EV_LISTEN for its
+ * listening socket; else one of the special values. Those have all upper bits
+ * set, EV_LISTEN included, hence IS_LISTEN() to tell them apart */
+#define EV_LISTEN       ((uint64_t) 1 << 32)
+#define IS_LISTEN(u64)  (((u64) >> 32) == 1)
+#define EV_SIGNAL       ((uint64_t) -1)
+#define EV_INOTIFY      ((uint64_t) -2)
+#define EV_GATE         ((uint64_t) -3)
+#define EV_STATUS       ((uint64_t) -4)
+#define EV_TIMER        ((uint64_t) -5)
+#define EV_DISPLAY      ((uint64_t) -6)
+
+/* how often to check whether the gate opened again, in ms */
+#define GATE_INTERVAL   250
+/* how often to sample resources used by applications, in ms */
+#define ACCOUNT_INTERVAL    250
+
+typedef enum {
+    NODE_WAITING = 0,   /* waiting on dependencies */
+    NODE_STARTED,       /* started, not ready yet */
+    NODE_READY,         /* started & ready (or nothing waits on it) */
+    NODE_FAILED,        /* not started, or failed before being ready */
+} node_state_t;
+
+typedef struct
+{
+    entry_t      *entry;
+    node_state_t  state;
+    int          *deps;         /* indexes of the nodes we wait on */
+    char         *required;     /* for each dep, whether it's required */
+    int           nb_deps;
+    int           nb_dependents;
+    int           mark;         /* for cycle detection */
+    int           pf_index;     /* for prefetch_wait() */
+    pid_t         pid;          /* 0 once reaped */
+    int           killed;       /* got SIGKILL when stopping */
+    long long     stop_ms;      /* how long it took to stop, -1 if not */
+    int           notify_fd;
+    int           listen_fd;    /* X-Dapper-Listen: not started yet */
+    long long     deadline;     /* in ms, on CLOCK_MONOTONIC */
+    pid_t         spawn_pid;    /* as spawned, kept once reaped */
+    int           wstatus;      /* from waitpid(), -1 until then */
+    long          spawn_at;     /* in us since ts_start, -1 if not spawned */
+    long          spawn_us;     /* how long fork() took */
+    account_t     acct;
+    int           delayed;      /* X-Dapper-Delay not over yet */
+} node_t;
+
+/* an entry that wasn't to be started, for status snapshots */
+typedef struct
+{
+    char       *name;
+    const char *reason;         /* Hidden, parse, OnlyShowIn, TryExec... */
+} skipped_t;
+
+struct _launch_t
+{
+    node_t     *nodes;
+    int         alloc;
+    int         len;
+    int         dry_run;
+    int         track;
+    int         stopping;       /* got SIGTERM/SIGINT (with track) */
+    long long   stop_start;
+    int         nb_running;     /* children not reaped yet */
+    int         resolved;       /* dependencies are known */
+    prefetch_t *pf;
+    gate_t     *gate;
+    int         gated;          /* launches were deferred by the gate */
+    int         nb_listening;
+    int         epfd;
+    int         sigfd;
+    int         inotify_fd;
+    sigset_t    old_mask;
+    struct timespec ts_start;
+    long        first_spawn;    /* in us since ts_start, -1 until then */
+    const launch_backend_t *backend;    /* NULL for actual processes */
+    int         status;         /* LAUNCH_STATUS */
+    int         status_fd;
+    char        status_path[108];
+    skipped_t  *skipped;
+    int         nb_skipped;
+    long        account_window; /* in ms since ts_start; 0 if not accounting */
+    int         account_json;
+    int         accounted;      /* report was printed */
+    long        next_sample;
+    wheel_t    *wheel;          /* for X-Dapper-Delay */
+    display_t  *display;        /* to wait for, before GUI launches */
+};
+
+/* in us since ts_start */
+static long
+elapsed_us (launch_t *launch)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec - launch->ts_start.tv_sec) * 1000000
+        + (ts.tv_nsec - launch->ts_start.tv_nsec) / 1000;
+}
+
+static void
+set_first_spawn (launch_t *launch)
+{
+    if (launch->first_spawn >= 0 || launch->backend)
+    {
+        return;
+    }
+    launch->first_spawn = elapsed_us (launch);
+}
+
+static long long
+now_ms (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* now_ms() as far as readiness deadlines go, i.e. per the backend if any */
+static long long
+launch_now (launch_t *launch)
+{
+    if (launch->backend)
+    {
+        return launch->backend->now (launch->backend->data);
+    }
+    return now_ms ();
+}
+
+static int
+find_node (launch_t *launch, const char *name, size_t len)
+{
+    int i;
+
+    for (i = 0; i < launch->len; ++i)
+    {
+        const char *n = launch->nodes[i].entry->name;
+
+        /* the .desktop suffix is optional */
+        if (strncmp (n, name, len) == 0
+                && (n[len] == '\0' || strcmp (n + len, ".desktop") == 0))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void
+add_deps (launch_t *launch, node_t *node, const char *list, int required)
+{
+    const char *s;
+    const char *e;
+    size_t      len;
+    int         dep;
+    int         i;
+
+    for (s = list; *s; s = (*e) ? e + 1 : e)
+    {
+        if (!(e = strchr (s, ';')))
+        {
+            e = s + strlen (s);
+        }
+        for ( ; *s == ' '; ++s)
+            ;
+        len = (size_t) (e - s);
+        if (len == 0)
+        {
+            continue;
+        }
+
+        if ((dep = find_node (launch, s, len)) < 0)
+        {
+            if (required)
+            {
+                p (LVL_VERBOSE, "%s: requires %.*s, which is not to be started, "
+                        "no auto-start\n", node->entry->name, (int) len, s);
+                node->state = NODE_FAILED;
+            }
+            else
+            {
+                p (LVL_DEBUG, "%s: after %.*s, which is not to be started, "
+                        "ignoring\n", node->entry->name, (int) len, s);
+            }
+            continue;
+        }
+
+        /* already listed? (e.g. in both After & Requires) */
+        for (i = 0; i < node->nb_deps; ++i)
+        {
+            if (node->deps[i] == dep)
+            {
+                break;
+            }
+        }
+        if (i < node->nb_deps)
+        {
+            node->required[i] |= (char) required;
+            continue;
+        }
+
+        node->deps = realloc (node->deps,
+                sizeof (*node->deps) * (size_t) (node->nb_deps + 1));
+        node->required = realloc (node->required,
+                sizeof (*node->required) * (size_t) (node->nb_deps + 1));
+        node->deps[node->nb_deps] = dep;
+        node->required[node->nb_deps] = (char) required;
+        ++node->nb_deps;
+        ++launch->nodes[dep].nb_dependents;
+    }
+}
+
+/* DFS from node i; mark: 0 = unvisited, 1 = on stack, 2 = done. stack holds
+ * the current path, so when a node on it is reached, we have a cycle */
+static void
+find_cycles (launch_t *launch, int i, int *stack, int depth)
+{
+    node_t *node = &launch->nodes[i];
+    int     j;
+    int     k;
+
+    node->mark = 1;
+    stack[depth] = i;
+
+    for (j = 0; j < node->nb_deps; ++j)
+    {
+        node_t *dep = &launch->nodes[node->deps[j]];
+
+        if (dep->mark == 1)
+        {
+            /* found a cycle: from dep (on the stack) to us */
+            for (k = depth; stack[k] != node->deps[j]; --k)
+                ;
+            p (LVL_ERROR, "dependency cycle: ");
+            for ( ; k <= depth; ++k)
+            {
+                p (LVL_ERROR, "%s -> ", launch->nodes[stack[k]].entry->name);
+                launch->nodes[stack[k]].state = NODE_FAILED;
+            }
+            p (LVL_ERROR, "%s\n", dep->entry->name);
+        }
+        else if (dep->mark == 0)
+        {
+            find_cycles (launch, node->deps[j], stack, depth + 1);
+        }
+    }
+
+    node->mark = 2;
+}
+
+static void
+check_cycles (launch_t *launch)
+{
+    int *stack;
+    int  i;
+
+    stack = malloc (sizeof (*stack) * (size_t) launch->len);
+    for (i = 0; i < launch->len; ++i)
+    {
+        if (launch->nodes[i].mark == 0)
+        {
+            find_cycles (launch, i, stack, 0);
+        }
+    }
+    free (stack);
+}
+
+static void
+set_state (launch_t *launch, node_t *node, node_state_t state, const char *why)
+{
+    TRACE (state, node->entry->name, (int) state, why);
+    if (state == NODE_READY)
+    {
+        p (LVL_VERBOSE, "%s: ready (%s)\n", node->entry->name, why);
+    }
+    else
+    {
+        p (LVL_VERBOSE, "%s: failed (%s)\n", node->entry->name, why);
+    }
+    node->state = state;
+    if (node->notify_fd >= 0)
+    {
+        epoll_ctl (launch->epfd, EPOLL_CTL_DEL, node->notify_fd, NULL);
+        close (node->notify_fd);
+        node->notify_fd = -1;
+    }
+}
+
+static int
+init_events (launch_t *launch)
+{
+    struct epoll_event ev;
+    sigset_t           mask;
+
+    if ((launch->epfd = epoll_create1 (EPOLL_CLOEXEC)) < 0)
+    {
+        p (LVL_ERROR, "unable to create epoll: %s\n", strerror (errno));
+        return 0;
+    }
+
+    /* SIGCHLD, to know when a child dies before being ready */
+    sigemptyset (&mask);
+    sigaddset (&mask, SIGCHLD);
+    if (launch->track || launch->status)
+    {
+        sigaddset (&mask, SIGTERM);
+        sigaddset (&mask, SIGINT);
+    }
+    sigprocmask (SIG_BLOCK, &mask, NULL);
+    if ((launch->sigfd = signalfd (-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0)
+    {
+        p (LVL_ERROR, "unable to create signalfd: %s\n", strerror (errno));
+        return 0;
+    }
+    ev.events = EPOLLIN;
+    ev.data.u64 = EV_SIGNAL;
+    epoll_ctl (launch->epfd, EPOLL_CTL_ADD, launch->sigfd, &ev);
+
+    /* for X-Dapper-ReadyFile */
+    if ((launch->inotify_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC)) >= 0)
+    {
+        ev.events = EPOLLIN;
+        ev.data.u64 = EV_INOTIFY;
+        epoll_ctl (launch->epfd, EPOLL_CTL_ADD, launch->inotify_fd, &ev);
+    }
+
+    return 1;
+}
+
+/* creates the NOTIFY_SOCKET for node, in the abstract namespace. Returns the
+ * value for NOTIFY_SOCKET in buf */
+static int
+open_notify (launch_t *launch, node_t *node, char *buf, size_t len)
+{
+    struct sockaddr_un  addr;
+    struct epoll_event  ev;
+    socklen_t           addr_len;
+    int                 fd;
+    int                 l;
+
+    if ((fd = socket (AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0)) < 0)
+    {
+        return -1;
+    }
+
+    memset (&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    l = snprintf (buf, len, "@dapper/%d/%d", (int) getpid (),
+            (int) (node - launch->nodes));
+    memcpy (addr.sun_path + 1, buf + 1, (size_t) l - 1);
+    addr_len = (socklen_t) (offsetof (struct sockaddr_un, sun_path) + (size_t) l);
+    if (bind (fd, (struct sockaddr *) &addr, addr_len) < 0)
+    {
+        close (fd);
+        return -1;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.u64 = (uint64_t) (node - launch->nodes);
+    epoll_ctl (launch->epfd, EPOLL_CTL_ADD, fd, &ev);
+    return fd;
+}
+
+/* fork & exec node's command line; if the node has a listening socket, it's
+ * passed as fd 3 as per the LISTEN_FDS convention */
+static pid_t
+spawn_node (launch_t *launch, node_t *node, const char *notify)
+{
+    entry_t *entry = node->entry;
+    char   **a;
+
+    p (LVL_VERBOSE, "%s: starting %s\n", entry->name, entry->argv[0]);
+    set_first_spawn (launch);
+    if (launch->backend)
+    {
+        return launch->backend->spawn (launch->backend->data,
+                (int) (node - launch->nodes), entry);
+    }
+    TRACE (spawn__fork, entry->name, entry->argv[0]);
+    node->spawn_at = elapsed_us (launch);
+    node->pid = fork ();
+    if (node->pid == 0)
+    {
+        /* child */
+        sigprocmask (SIG_SETMASK, &launch->old_mask, NULL);
+        if (launch->track)
+        {
+            /* so stopping it also stops whatever it started (e.g. sh -c) */
+            setpgid (0, 0);
+        }
+        if (launch->display && !entry->headless)
+        {
+            const char *value;
+            const char *env = display_env (launch->display, &value);
+
+            if (env)
+            {
+                setenv (env, value, 1);
+            }
+        }
+        if (notify)
+        {
+            setenv ("NOTIFY_SOCKET", notify, 1);
+        }
+        else
+        {
+            unsetenv ("NOTIFY_SOCKET");
+        }
+        if (node->listen_fd >= 0)
+        {
+            char   buf[32];
+            size_t l;
+
+            if (node->listen_fd == 3)
+            {
+                fcntl (3, F_SETFD, 0);
+            }
+            else if (dup2 (node->listen_fd, 3) < 0)
+            {
+                exit (1);
+            }
+            snprintf (buf, sizeof (buf), "%d", (int) getpid ());
+            setenv ("LISTEN_PID", buf, 1);
+            setenv ("LISTEN_FDS", "1", 1);
+            /* name of the .desktop, without suffix */
+            l = strlen (entry->name);
+            if (l > 8 && strcmp (entry->name + l - 8, ".desktop") == 0)
+            {
+                entry->name[l - 8] = '\0';
+            }
+            setenv ("LISTEN_FDNAMES", entry->name, 1);
+        }
+        else
+        {
+            unsetenv ("LISTEN_PID");
+            unsetenv ("LISTEN_FDS");
+            unsetenv ("LISTEN_FDNAMES");
+        }
+        /* from an unwrapped env or sh -c, see unwrap_exec() */
+        for (a = entry->env; a && *a; ++a)
+        {
+            putenv (*a);
+        }
+        TRACE (spawn__exec, entry->name, entry->argv[0]);
+        execvp (entry->argv[0], entry->argv);
+        exit (1);
+    }
+    else if (node->pid == -1)
+    {
+        p (LVL_ERROR, "%s: unable to fork\n", entry->file);
+    }
+    else
+    {
+        node->spawn_us = elapsed_us (launch) - node->spawn_at;
+        node->spawn_pid = node->pid;
+        account_start (&node->acct, entry->name, node->pid, node->spawn_at / 1000);
+        if (launch->track)
+        {
+            /* also from the parent, to not race with the child */
+            setpgid (node->pid, node->pid);
+        }
+        ++launch->nb_running;
+    }
+    TRACE (spawn__forked, entry->name, node->pid);
+    return node->pid;
+}
+
+/* binds & listens on X-Dapper-Listen; the node will only be started on the
+ * first connection. Returns -1 if something already listens there */
+static int
+open_listen (launch_t *launch, node_t *node)
+{
+    struct sockaddr_un  addr;
+    struct epoll_event  ev;
+    struct stat         statbuf;
+    const char         *path = node->entry->listen;
+    int                 fd;
+
+    if (strlen (path) >= sizeof (addr.sun_path))
+    {
+        p (LVL_ERROR, "%s: socket path too long: %s\n", node->entry->name, path);
+        return 0;
+    }
+    if ((fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0)) < 0)
+    {
+        p (LVL_ERROR, "%s: unable to create socket: %s\n",
+                node->entry->name, strerror (errno));
+        return 0;
+    }
+
+    memset (&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    strcpy (addr.sun_path, path);
+    /* don't steal the socket of a live instance; only remove a stale one,
+     * e.g. from a previous session */
+    if (connect (fd, (struct sockaddr *) &addr, sizeof (addr)) == 0
+            || (errno != ECONNREFUSED && errno != ENOENT))
+    {
+        p (LVL_ERROR, "%s: socket %s already in use\n", node->entry->name, path);
+        close (fd);
+        return -1;
+    }
+    if (errno == ECONNREFUSED && lstat (path, &statbuf) == 0
+            && S_ISSOCK (statbuf.st_mode))
+    {
+        unlink (path);
+    }
+    /* non-blocking only for the probe: it's handed over to the application,
+     * which expects a blocking one; we only wait for it to be readable */
+    if (bind (fd, (struct sockaddr *) &addr, sizeof (addr)) < 0
+            || listen (fd, SOMAXCONN) < 0
+            || fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) & ~O_NONBLOCK) < 0)
+    {
+        p (LVL_ERROR, "%s: unable to listen on %s: %s\n",
+                node->entry->name, path, strerror (errno));
+        close (fd);
+        return 0;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.u64 = (uint64_t) (node - launch->nodes) | EV_LISTEN;
+    epoll_ctl (launch->epfd, EPOLL_CTL_ADD, fd, &ev);
+    node->listen_fd = fd;
+    ++launch->nb_listening;
+    return 1;
+}
+
+static void
+process_listen (launch_t *launch, node_t *node)
+{
+    p (LVL_VERBOSE, "%s: connection on %s\n", node->entry->name, node->entry->listen);
+    epoll_ctl (launch->epfd, EPOLL_CTL_DEL, node->listen_fd, NULL);
+    spawn_node (launch, node, NULL);
+    close (node->listen_fd);
+    node->listen_fd = -1;
+    --launch->nb_listening;
+}
+
+static void
+start_node (launch_t *launch, node_t *node)
+{
+    entry_t *entry = node->entry;
+    char     notify[64];
+    char   **a;
+    /* whether we can wait for readiness at all */
+    int      events = (launch->sigfd >= 0 || launch->backend);
+    int      tracked = 0;
+
+    if (entry->running)
+    {
+        if (launch->dry_run)
+        {
+            p (LVL_NORMAL, "already running: %s\n", entry->argv[0]);
+        }
+        set_state (launch, node, NODE_READY, "already running");
+        return;
+    }
+
+    if (launch->pf)
+    {
+        prefetch_wait (launch->pf, node->pf_index);
+    }
+
+    if (launch->dry_run)
+    {
+        set_first_spawn (launch);
+        if (entry->listen)
+        {
+            p (LVL_NORMAL, "auto-start on connection to %s:", entry->listen);
+        }
+        else if (entry->delay > 0)
+        {
+            p (LVL_NORMAL, "auto-start after %d s:", entry->delay);
+        }
+        else
+        {
+            p (LVL_NORMAL, "auto-start:");
+        }
+        for (a = entry->env; a && *a; ++a)
+        {
+            p (LVL_NORMAL, " %s", *a);
+        }
+        for (a = entry->argv; *a; ++a)
+        {
+            p (LVL_NORMAL, " %s", *a);
+        }
+        p (LVL_NORMAL, "\n");
+        node->state = NODE_READY;
+        return;
+    }
+
+    /* socket activation: as far as dependencies go, we're ready once the
+     * socket is listening */
+    if (entry->listen && launch->backend)
+    {
+        set_state (launch, node, NODE_READY, "listening");
+        return;
+    }
+    if (entry->listen && launch->sigfd >= 0)
+    {
+        int r = open_listen (launch, node);
+
+        if (r > 0)
+        {
+            set_state (launch, node, NODE_READY, "listening");
+            return;
+        }
+        else if (r < 0)
+        {
+            /* e.g. still running from an earlier session */
+            set_state (launch, node, NODE_READY, "socket in use");
+            return;
+        }
+        p (LVL_VERBOSE, "%s: starting right away instead\n", entry->name);
+    }
+
+    /* only track readiness if someone is (or might be) waiting on us */
+    node->notify_fd = -1;
+    if (events && entry->ready_timeout > 0
+            && (!launch->resolved || node->nb_dependents > 0))
+    {
+        tracked = 1;
+    }
+    if (tracked && launch->sigfd >= 0)
+    {
+        node->notify_fd = open_notify (launch, node, notify, sizeof (notify));
+        if (entry->ready_file && launch->inotify_fd >= 0)
+        {
+            char *s = strrchr (entry->ready_file, '/');
+
+            if (s && s > entry->ready_file)
+            {
+                *s = '\0';
+                inotify_add_watch (launch->inotify_fd, entry->ready_file,
+                        IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE);
+                *s = '/';
+            }
+        }
+    }
+
+    if (spawn_node (launch, node, (node->notify_fd >= 0) ? notify : NULL) < 0)
+    {
+        set_state (launch, node, NODE_FAILED, "fork");
+        return;
+    }
+
+    if (!tracked && (launch->resolved || !events) && node->nb_dependents == 0)
+    {
+        node->state = NODE_READY;
+    }
+    else if (entry->ready_timeout == 0 || !events)
+    {
+        set_state (launch, node, NODE_READY, "no ready timeout");
+    }
+    else if (!launch->backend && entry->ready_file
+            && access (entry->ready_file, F_OK) == 0)
+    {
+        set_state (launch, node, NODE_READY, "file exists");
+    }
+    else
+    {
+        node->state = NODE_STARTED;
+        node->deadline = launch_now (launch) + entry->ready_timeout * 1000;
+    }
+}
+
+/* whether node can be started as far as the gate goes; gate_closed is used to
+ * only check it once when closed */
+static int
+gate_allows (launch_t *launch, node_t *node, int *gate_closed)
+{
+    if (!launch->gate || node->entry->critical || node->entry->running)
+    {
+        return 1;
+    }
+    if (!*gate_closed && !gate_is_open (launch->gate))
+    {
+        *gate_closed = 1;
+    }
+    if (*gate_closed)
+    {
+        launch->gated = 1;
+        return 0;
+    }
+    return 1;
+}
+
+/* whether node can be started as far as the display goes, i.e. it doesn't need
+ * one, or it is ready; display_waiting is used to only check it once */
+static int
+display_allows (launch_t *launch, node_t *node, int *display_waiting)
+{
+    if (!launch->display || node->entry->headless || node->entry->running)
+    {
+        return 1;
+    }
+    if (!*display_waiting && !display_is_ready (launch->display))
+    {
+        *display_waiting = 1;
+    }
+    return !*display_waiting;
+}
+
+/* start all nodes that can be; returns the number of nodes still waiting */
+static int
+start_nodes (launch_t *launch)
+{
+    int gate_closed = 0;
+    int display_waiting = 0;
+    int progress;
+    int waiting;
+    int i;
+    int j;
+
+    launch->gated = 0;
+
+    do
+    {
+        progress = 0;
+        waiting = 0;
+        for (i = 0; i < launch->len; ++i)
+        {
+            node_t *node = &launch->nodes[i];
+            int     can_start = 1;
+
+            if (node->state != NODE_WAITING)
+            {
+                continue;
+            }
+
+            for (j = 0; j < node->nb_deps; ++j)
+            {
+                node_t *dep = &launch->nodes[node->deps[j]];
+
+                if (dep->state == NODE_WAITING || dep->state == NODE_STARTED)
+                {
+                    can_start = 0;
+                }
+                else if (dep->state == NODE_FAILED && node->required[j])
+                {
+                    p (LVL_VERBOSE, "%s: required %s failed, no auto-start\n",
+                            node->entry->name, dep->entry->name);
+                    node->state = NODE_FAILED;
+                    progress = 1;
+                    break;
+                }
+            }
+
+            if (node->state == NODE_WAITING)
+            {
+                if (node->delayed)
+                {
+                    can_start = 0;
+                }
+                if (can_start && !display_allows (launch, node, &display_waiting))
+                {
+                    can_start = 0;
+                }
+                if (can_start && !gate_allows (launch, node, &gate_closed))
+                {
+                    can_start = 0;
+                }
+                if (can_start)
+                {
+                    start_node (launch, node);
+                    progress = 1;
+                }
+                else
+                {
+                    ++waiting;
+                }
+            }
+        }
+    } while (progress);
+
+    return waiting;
+}
+
+static void
+process_notify (launch_t *launch, node_t *node)
+{
+    char    buf[4096];
+    ssize_t len;
+    char   *s;
+    char   *e;
+
+    while ((len = recv (node->notify_fd, buf, sizeof (buf) - 1, 0)) > 0)
+    {
+        buf[len] = '\0';
+        for (s = buf; *s; s = (*e) ? e + 1 : e)
+        {
+            if (!(e = strchr (s, '\n')))
+            {
+                e = s + strlen (s);
+            }
+            if (e - s == 7 && strncmp (s, "READY=1", 7) == 0)
+            {
+                set_state (launch, node, NODE_READY, "notified");
+                return;
+            }
+            p (LVL_DEBUG, "%s: notify: %.*s\n", node->entry->name, (int) (e - s), s);
+        }
+    }
+}
+
+static void
+process_signals (launch_t *launch)
+{
+    struct signalfd_siginfo si;
+    struct rusage           ru;
+    pid_t                   pid;
+    int                     status;
+    int                     i;
+
+    while (read (launch->sigfd, &si, sizeof (si)) == sizeof (si))
+    {
+        if ((si.ssi_signo == SIGTERM || si.ssi_signo == SIGINT)
+                && !launch->stopping)
+        {
+            p (LVL_VERBOSE, "got %s, %s\n",
+                    (si.ssi_signo == SIGTERM) ? "SIGTERM" : "SIGINT",
+                    (launch->track) ? "stopping applications" : "exiting");
+            launch->stopping = 1;
+        }
+    }
+
+    while ((pid = wait4 (-1, &status, WNOHANG, &ru)) > 0)
+    {
+        for (i = 0; i < launch->len; ++i)
+        {
+            node_t *node = &launch->nodes[i];
+
+            if (node->pid != pid)
+            {
+                continue;
+            }
+            node->pid = 0;
+            node->wstatus = status;
+            account_exited (&node->acct, status, &ru, elapsed_us (launch) / 1000);
+            --launch->nb_running;
+            if (launch->stop_start > 0)
+            {
+                node->stop_ms = now_ms () - launch->stop_start;
+                p (LVL_VERBOSE, "%s: stopped in %lld ms\n",
+                        node->entry->name, node->stop_ms);
+            }
+            else if (launch->track && node->state != NODE_STARTED)
+            {
+                p (LVL_VERBOSE, "%s: exited\n", node->entry->name);
+            }
+            if (node->state != NODE_STARTED)
+            {
+                break;
+            }
+            if (WIFEXITED (status) && WEXITSTATUS (status) == 0)
+            {
+                set_state (launch, node, NODE_READY, "exited");
+            }
+            else
+            {
+                set_state (launch, node, NODE_FAILED, "died before being ready");
+            }
+            break;
+        }
+    }
+}
+
+static void
+process_inotify (launch_t *launch)
+{
+    char buf[4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+    int  i;
+
+    while (read (launch->inotify_fd, buf, sizeof (buf)) > 0)
+        ;
+
+    for (i = 0; i < launch->len; ++i)
+    {
+        node_t *node = &launch->nodes[i];
+
+        if (node->state == NODE_STARTED && node->entry->ready_file
+                && access (node->entry->ready_file, F_OK) == 0)
+        {
+            set_state (launch, node, NODE_READY, "file appeared");
+        }
+    }
+}
+
+/* binds & listens on the status socket, see serve_status() */
+static void
+open_status (launch_t *launch)
+{
+    struct sockaddr_un  addr;
+    struct epoll_event  ev;
+    int                 fd;
+
+    if (!get_runtime_file (launch->status_path, sizeof (addr.sun_path), "sock"))
+    {
+        p (LVL_ERROR, "unable to get path of status socket\n");
+        return;
+    }
+    if ((fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0)) < 0)
+    {
+        p (LVL_ERROR, "unable to create status socket: %s\n", strerror (errno));
+        return;
+    }
+
+    memset (&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    strcpy (addr.sun_path, launch->status_path);
+    /* don't steal the socket of another dapper; only remove a stale one, e.g.
+     * from a previous session */
+    if (connect (fd, (struct sockaddr *) &addr, sizeof (addr)) == 0
+            || (errno != ECONNREFUSED && errno != ENOENT))
+    {
+        p (LVL_ERROR, "status socket %s already in use\n", launch->status_path);
+        close (fd);
+        return;
+    }
+    if (errno == ECONNREFUSED)
+    {
+        unlink (launch->status_path);
+    }
+    if (bind (fd, (struct sockaddr *) &addr, sizeof (addr)) < 0
+            || listen (fd, SOMAXCONN) < 0)
+    {
+        p (LVL_ERROR, "unable to listen on %s: %s\n",
+                launch->status_path, strerror (errno));
+        close (fd);
+        return;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.u64 = EV_STATUS;
+    epoll_ctl (launch->epfd, EPOLL_CTL_ADD, fd, &ev);
+    launch->status_fd = fd;
+}
+
+static const char *
+node_decision (node_t *node)
+{
+    if (node->entry->running)
+    {
+        return "running";
+    }
+    else if (node->spawn_pid > 0)
+    {
+        return "started";
+    }
+    else if (node->listen_fd >= 0)
+    {
+        return "listening";
+    }
+    else if (node->delayed)
+    {
+        return "delayed";
+    }
+    return (node->state == NODE_FAILED) ? "failed" : "waiting";
+}
+
+/* sends a snapshot to whoever connected, and hangs up. It's one line for
+ * dapper, one for counters, then one per entry; all made of key=value */
+static void
+serve_status (launch_t *launch)
+{
+    static const char *states[] = { "waiting", "starting", "ready", "failed" };
+    char              *buf;
+    size_t             len;
+    FILE              *fp;
+    int                nb[4] = { 0, 0, 0, 0 };
+    int                nb_started = 0;
+    int                fd;
+    int                i;
+
+    while ((fd = accept4 (launch->status_fd, NULL, NULL, SOCK_CLOEXEC)) >= 0)
+    {
+        if (!(fp = open_memstream (&buf, &len)))
+        {
+            close (fd);
+            continue;
+        }
+        for (i = 0; i < launch->len; ++i)
+        {
+            ++nb[launch->nodes[i].state];
+            nb_started += (launch->nodes[i].spawn_pid > 0);
+        }
+        fprintf (fp, "dapper pid=%d uptime_ms=%ld first_spawn_us=%ld\n",
+                (int) getpid (), elapsed_us (launch) / 1000, launch->first_spawn);
+        fprintf (fp, "counters entries=%d started=%d alive=%d ready=%d failed=%d "
+                "skipped=%d\n", launch->len, nb_started, launch->nb_running,
+                nb[NODE_READY], nb[NODE_FAILED], launch->nb_skipped);
+        for (i = 0; i < launch->len; ++i)
+        {
+            node_t *node = &launch->nodes[i];
+
+            fprintf (fp, "entry name=%s decision=%s state=%s", node->entry->name,
+                    node_decision (node), states[node->state]);
+            if (node->spawn_pid > 0)
+            {
+                fprintf (fp, " pid=%d", (int) node->spawn_pid);
+                if (node->pid > 0)
+                {
+                    fprintf (fp, " status=alive");
+                }
+                else if (WIFEXITED (node->wstatus))
+                {
+                    fprintf (fp, " status=exited:%d", WEXITSTATUS (node->wstatus));
+                }
+                else
+                {
+                    fprintf (fp, " status=killed:%d", WTERMSIG (node->wstatus));
+                }
+                fprintf (fp, " at_us=%ld spawn_us=%ld", node->spawn_at, node->spawn_us);
+            }
+            fprintf (fp, "\n");
+        }
+        for (i = 0; i < launch->nb_skipped; ++i)
+        {
+            fprintf (fp, "entry name=%s decision=%s\n", launch->skipped[i].name,
+                    launch->skipped[i].reason);
+        }
+        fclose (fp);
+
+        /* never wait on a client: what doesn't fit in the socket buffer right
+         * away is dropped, along with the client */
+        if (send (fd, buf, len, MSG_NOSIGNAL | MSG_DONTWAIT) != (ssize_t) len)
+        {
+            p (LVL_VERBOSE, "status: dropping slow client\n");
+        }
+        close (fd);
+        free (buf);
+    }
+}
+
+/* wheel_fn, for X-Dapper-Delay */
+static void
+delay_over (int id, void *data)
+{
+    launch_t *launch = data;
+
+    p (LVL_VERBOSE, "%s: delay over\n", launch->nodes[id].entry->name);
+    launch->nodes[id].delayed = 0;
+}
+
+static void
+report_account (launch_t *launch)
+{
+    account_t **accts;
+    int         nb = 0;
+    int         i;
+
+    launch->accounted = 1;
+    accts = malloc (sizeof (*accts) * (size_t) (launch->len + 1));
+    for (i = 0; i < launch->len; ++i)
+    {
+        if (launch->nodes[i].spawn_pid > 0)
+        {
+            accts[nb++] = &launch->nodes[i].acct;
+        }
+    }
+    account_report (accts, nb, elapsed_us (launch) / 1000, launch->account_json);
+    free (accts);
+}
+
+/* whether some node is yet to be started (e.g. waiting on a dependency or its
+ * X-Dapper-Delay) or ready; listening ones might never be, so they don't count */
+static int
+has_pending (launch_t *launch)
+{
+    int i;
+
+    for (i = 0; i < launch->len; ++i)
+    {
+        node_t *node = &launch->nodes[i];
+
+        if (node->state == NODE_STARTED
+                || (node->state == NODE_WAITING && node->listen_fd < 0))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* samples all running applications, and reports once the window is over or
+ * there's nothing left to sample, nor to start */
+static void
+sample_nodes (launch_t *launch)
+{
+    long now = elapsed_us (launch) / 1000;
+    int  i;
+
+    if (now < launch->next_sample && launch->nb_running > 0)
+    {
+        return;
+    }
+    for (i = 0; i < launch->len; ++i)
+    {
+        if (launch->nodes[i].pid > 0)
+        {
+            account_sample (&launch->nodes[i].acct, now);
+        }
+    }
+    launch->next_sample = now + ACCOUNT_INTERVAL;
+    if (now >= launch->account_window
+            || (launch->nb_running == 0 && !has_pending (launch)))
+    {
+        report_account (launch);
+    }
+}
+
+static void
+wait_events (launch_t *launch)
+{
+    struct epoll_event events[16];
+    long long          now = launch_now (launch);
+    long long          deadline = -1;
+    int                timeout;
+    int                nb;
+    int                i;
+
+    for (i = 0; i < launch->len; ++i)
+    {
+        node_t *node = &launch->nodes[i];
+
+        if (node->state == NODE_STARTED
+                && (deadline < 0 || node->deadline < deadline))
+        {
+            deadline = node->deadline;
+        }
+        /* with a backend, time is its own (with 0 for login) */
+        else if (launch->backend && node->delayed
+                && (deadline < 0 || node->entry->delay * 1000LL < deadline))
+        {
+            deadline = node->entry->delay * 1000LL;
+        }
+    }
+    timeout = (deadline < 0) ? -1
+        : (deadline <= now) ? 0 : (int) (deadline - now);
+    if (launch->gated && (timeout < 0 || timeout > GATE_INTERVAL))
+    {
+        timeout = GATE_INTERVAL;
+    }
+    if (launch->display)
+    {
+        long t = display_next (launch->display);
+
+        if (t >= 0 && (timeout < 0 || timeout > t))
+        {
+            timeout = (int) t;
+        }
+    }
+    if (launch->account_window > 0 && !launch->accounted)
+    {
+        long t = launch->next_sample - elapsed_us (launch) / 1000;
+
+        t = (t < 0) ? 0 : t;
+        if (timeout < 0 || timeout > t)
+        {
+            timeout = (int) t;
+        }
+    }
+
+    if (launch->backend)
+    {
+        /* nothing can happen anymore, so nothing else can be started */
+        if (launch->backend->wait (launch->backend->data,
+                    (deadline < 0) ? -1 : deadline - now) < 0)
+        {
+            launch->stopping = 1;
+        }
+        nb = 0;
+    }
+    else
+    {
+        nb = epoll_wait (launch->epfd, events, 16, timeout);
+    }
+    for (i = 0; i < nb; ++i)
+    {
+        if (events[i].data.u64 == EV_SIGNAL)
+        {
+            process_signals (launch);
+        }
+        else if (events[i].data.u64 == EV_GATE)
+        {
+            gate_triggered (launch->gate);
+        }
+        else if (events[i].data.u64 == EV_STATUS)
+        {
+            serve_status (launch);
+        }
+        else if (events[i].data.u64 == EV_TIMER)
+        {
+            wheel_expire (launch->wheel, delay_over, launch);
+        }
+        else if (events[i].data.u64 == EV_DISPLAY)
+        {
+            display_event (launch->display);
+        }
+        else if (IS_LISTEN (events[i].data.u64))
+        {
+            node_t *node = &launch->nodes[events[i].data.u64 & ~EV_LISTEN];
+
+            if (node->listen_fd >= 0)
+            {
+                process_listen (launch, node);
+            }
+        }
+        else if (events[i].data.u64 == EV_INOTIFY)
+        {
+            process_inotify (launch);
+        }
+        else
+        {
+            node_t *node = &launch->nodes[events[i].data.u64];
+
+            if (node->notify_fd >= 0)
+            {
+                process_notify (launch, node);
+            }
+        }
+    }
+
+    now = launch_now (launch);
+    for (i = 0; i < launch->len; ++i)
+    {
+        if (launch->nodes[i].state == NODE_STARTED
+                && launch->nodes[i].deadline <= now)
+        {
+            set_state (launch, &launch->nodes[i], NODE_READY, "timeout");
+        }
+        else if (launch->backend && launch->nodes[i].delayed
+                && launch->nodes[i].entry->delay * 1000LL <= now)
+        {
+            delay_over (i, launch);
+        }
+    }
+
+    if (launch->account_window > 0 && !launch->accounted)
+    {
+        sample_nodes (launch);
+    }
+}
+
+static void
+signal_node (node_t *node, int sig)
+{
+    /* the whole process group if possible */
+    if (kill (-node->pid, sig) < 0)
+    {
+        kill (node->pid, sig);
+    }
+}
+
+/* slowest to stop first */
+static int
+cmp_stop_ms (const void *n1, const void *n2)
+{
+    long long ms1 = (*(node_t * const *) n1)->stop_ms;
+    long long ms2 = (*(node_t * const *) n2)->stop_ms;
+
+    return (ms1 > ms2) ? -1 : (ms1 < ms2) ? 1 : 0;
+}
+
+/* stops all applications still running, all at once: SIGTERM first, then
+ * SIGKILL for those still running after their stop timeout */
+static void
+stop_nodes (launch_t *launch)
+{
+    struct pollfd      pfd;
+    node_t           **stopped;
+    int                nb_stopped = 0;
+    long long          now;
+    long long          deadline;
+    int                timeout;
+    int                nb = 0;
+    int                i;
+
+    /* from now on, only children matter */
+    for (i = 0; i < launch->len; ++i)
+    {
+        node_t *node = &launch->nodes[i];
+
+        if (node->notify_fd >= 0)
+        {
+            epoll_ctl (launch->epfd, EPOLL_CTL_DEL, node->notify_fd, NULL);
+            close (node->notify_fd);
+            node->notify_fd = -1;
+        }
+        if (node->listen_fd >= 0)
+        {
+            epoll_ctl (launch->epfd, EPOLL_CTL_DEL, node->listen_fd, NULL);
+            close (node->listen_fd);
+            node->listen_fd = -1;
+            unlink (node->entry->listen);
+            --launch->nb_listening;
+        }
+    }
+    if (launch->inotify_fd >= 0)
+    {
+        epoll_ctl (launch->epfd, EPOLL_CTL_DEL, launch->inotify_fd, NULL);
+    }
+    /* only signals are waited on: anything else left in epfd (delays, status
+     * socket, display) would never be drained, and we'd spin */
+    pfd.fd = launch->sigfd;
+    pfd.events = POLLIN;
+
+    launch->stop_start = now_ms ();
+    for (i = 0; i < launch->len; ++i)
+    {
+        node_t *node = &launch->nodes[i];
+
+        if (node->pid > 0)
+        {
+            p (LVL_VERBOSE, "%s: stopping (pid %d)\n", node->entry->name,
+                    (int) node->pid);
+            signal_node (node, SIGTERM);
+            node->deadline = launch->stop_start + node->entry->stop_timeout * 1000;
+            ++nb;
+        }
+    }
+
+    while (launch->nb_running > 0)
+    {
+        deadline = -1;
+        for (i = 0; i < launch->len; ++i)
+        {
+            node_t *node = &launch->nodes[i];
+
+            if (node->pid > 0 && !node->killed
+                    && (deadline < 0 || node->deadline < deadline))
+            {
+                deadline = node->deadline;
+            }
+        }
+        now = now_ms ();
+        timeout = (deadline < 0) ? -1
+            : (deadline <= now) ? 0 : (int) (deadline - now);
+
+        if (poll (&pfd, 1, timeout) > 0)
+        {
+            process_signals (launch);
+        }
+
+        now = now_ms ();
+        for (i = 0; i < launch->len; ++i)
+        {
+            node_t *node = &launch->nodes[i];
+
+            if (node->pid > 0 && !node->killed && node->deadline <= now)
+            {
+                p (LVL_ERROR, "%s: still running after %d seconds, killing\n",
+                        node->entry->name, node->entry->stop_timeout);
+                signal_node (node, SIGKILL);
+                node->killed = 1;
+            }
+        }
+    }
+
+    /* all of them, slowest first: whichever held up logout */
+    stopped = malloc (sizeof (*stopped) * (size_t) (launch->len + 1));
+    for (i = 0; i < launch->len; ++i)
+    {
+        if (launch->nodes[i].stop_ms >= 0)
+        {
+            stopped[nb_stopped++] = &launch->nodes[i];
+        }
+    }
+    if (nb_stopped > 0)
+    {
+        qsort (stopped, (size_t) nb_stopped, sizeof (*stopped), cmp_stop_ms);
+        p (LVL_NORMAL, "stopped %d applications in %lld ms:\n",
+                nb, now_ms () - launch->stop_start);
+        for (i = 0; i < nb_stopped; ++i)
+        {
+            p (LVL_NORMAL, "  %-32s %6lld ms%s\n", stopped[i]->entry->name,
+                    stopped[i]->stop_ms, (stopped[i]->killed) ? " (killed)" : "");
+        }
+    }
+    free (stopped);
+}
+
+/* keeps running as long as applications we started are, until asked to stop
+ * them all (SIGTERM/SIGINT, e.g. from dapper --stop) */
+static void
+track_nodes (launch_t *launch)
+{
+    char  pidfile[4096];
+    FILE *fp = NULL;
+
+    /* else we're only serving status */
+    if (launch->track)
+    {
+        if (get_runtime_file (pidfile, sizeof (pidfile), "pid")
+                && (fp = fopen (pidfile, "w")))
+        {
+            fprintf (fp, "%d\n", (int) getpid ());
+            fclose (fp);
+        }
+        else
+        {
+            p (LVL_VERBOSE, "unable to write pid file, --stop won't work\n");
+        }
+    }
+
+    p (LVL_VERBOSE, "tracking %d applications\n", launch->nb_running);
+    while (!launch->stopping
+            && ((launch->track
+                    && (launch->nb_running > 0 || launch->nb_listening > 0))
+                || launch->status_fd >= 0
+                || (launch->account_window > 0 && !launch->accounted)))
+    {
+        wait_events (launch);
+    }
+
+    /* report what was used before stopping it all */
+    if (launch->account_window > 0 && !launch->accounted)
+    {
+        report_account (launch);
+    }
+    if (launch->stopping && launch->track)
+    {
+        stop_nodes (launch);
+    }
+
+    if (fp)
+    {
+        unlink (pidfile);
+    }
+}
+
+/* for dapper --stop: asks the running dapper --track to stop all
+ * applications, and waits until it's done */
+int
+launch_stop_tracked (void)
+{
+    struct pollfd pfd;
+    char          buf[4096];
+    char          comm[32] = "";
+    FILE         *fp;
+    int           pid = 0;
+    int           fd = -1;
+
+    if (!get_runtime_file (buf, sizeof (buf), "pid"))
+    {
+        p (LVL_ERROR, "unable to get pid file: XDG_RUNTIME_DIR not set\n");
+        return 1;
+    }
+    if ((fp = fopen (buf, "r")))
+    {
+        if (fscanf (fp, "%d", &pid) != 1)
+        {
+            pid = 0;
+        }
+        fclose (fp);
+    }
+    /* make sure it's not a stale pid file */
+    snprintf (buf, sizeof (buf), "/proc/%d/comm", pid);
+    if (pid > 0 && (fp = fopen (buf, "r")))
+    {
+        if (!fgets (comm, sizeof (comm), fp))
+        {
+            comm[0] = '\0';
+        }
+        fclose (fp);
+    }
+    if (strncmp (comm, PACKAGE_NAME, strlen (PACKAGE_NAME)) != 0)
+    {
+        p (LVL_ERROR, "no running dapper --track found\n");
+        return 1;
+    }
+
+#if defined (SYS_pidfd_open) && defined (SYS_pidfd_send_signal)
+    /* so we're sure to signal & wait for the right process */
+    if ((fd = (int) syscall (SYS_pidfd_open, pid, 0)) >= 0
+            && syscall (SYS_pidfd_send_signal, fd, SIGTERM, NULL, 0) < 0)
+    {
+        close (fd);
+        fd = -1;
+        p (LVL_ERROR, "unable to signal dapper (pid %d): %s\n", pid,
+                strerror (errno));
+        return 1;
+    }
+#endif
+    if (fd < 0 && kill (pid, SIGTERM) < 0)
+    {
+        p (LVL_ERROR, "unable to signal dapper (pid %d): %s\n", pid,
+                strerror (errno));
+        return 1;
+    }
+    p (LVL_VERBOSE, "waiting for dapper (pid %d) to stop applications\n", pid);
+
+    if (fd >= 0)
+    {
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        while (poll (&pfd, 1, -1) < 0 && errno == EINTR)
+            ;
+        close (fd);
+    }
+    else
+    {
+        struct timespec ts = { 0, 50 * 1000000 };
+
+        while (kill (pid, 0) == 0)
+        {
+            nanosleep (&ts, NULL);
+        }
+    }
+
+    return 0;
+}
+
+/* with a backend, nothing is actually started (and flags are ignored) */
+launch_t *
+launch_new (prefetch_t *pf, int flags, const struct timespec *ts_start,
+            const launch_backend_t *backend)
+{
+    launch_t *launch;
+
+    launch = calloc (1, sizeof (*launch));
+    launch->pf = pf;
+    launch->backend = backend;
+    if (backend)
+    {
+        flags = 0;
+    }
+    launch->dry_run = flags & LAUNCH_DRY_RUN;
+    launch->track = (flags & LAUNCH_TRACK) && !launch->dry_run;
+    launch->status = (flags & LAUNCH_STATUS) && !launch->dry_run;
+    launch->epfd = launch->sigfd = launch->inotify_fd = launch->status_fd = -1;
+    launch->ts_start = *ts_start;
+    launch->first_spawn = -1;
+    sigprocmask (SIG_BLOCK, NULL, &launch->old_mask);
+
+    /* on failure sigfd remains -1, and we'll only start things */
+    if (!launch->dry_run && !backend)
+    {
+        init_events (launch);
+    }
+    /* open early, so launching itself can be followed */
+    if (launch->status && launch->sigfd >= 0)
+    {
+        open_status (launch);
+    }
+
+    return launch;
+}
+
+/* adds entry to be started. If it doesn't have dependencies it's started right
+ * away, else it'll be when launch_run() is called, after all entries were
+ * added. */
+void
+launch_add (launch_t *launch, entry_t *entry)
+{
+    node_t *node;
+
+    if (launch->len == launch->alloc)
+    {
+        launch->alloc += 16;
+        launch->nodes = realloc (launch->nodes,
+                sizeof (*launch->nodes) * (size_t) launch->alloc);
+    }
+    node = &launch->nodes[launch->len++];
+    memset (node, 0, sizeof (*node));
+    node->entry = entry;
+    node->notify_fd = -1;
+    node->listen_fd = -1;
+    node->stop_ms = -1;
+    node->wstatus = -1;
+    node->spawn_at = -1;
+    if (launch->pf && !entry->running)
+    {
+        node->pf_index = prefetch_add (launch->pf, entry);
+    }
+
+    /* all delays are relative to the same point, when dapper started */
+    if (entry->delay > 0 && !entry->running && !launch->dry_run)
+    {
+        if (!launch->wheel && !launch->backend && launch->epfd >= 0)
+        {
+            launch->wheel = wheel_new (&launch->ts_start, launch->epfd, EV_TIMER);
+        }
+        if (launch->wheel)
+        {
+            wheel_add (launch->wheel, entry->delay * 1000L, launch->len - 1);
+        }
+        /* else it can't be waited for, and will be started right away */
+        node->delayed = (launch->wheel || launch->backend);
+    }
+
+    if (!entry->after && !entry->requires && !node->delayed)
+    {
+        int gate_closed = 0;
+        int display_waiting = 0;
+
+        /* else it'll be started from launch_run() */
+        if (display_allows (launch, node, &display_waiting)
+                && gate_allows (launch, node, &gate_closed))
+        {
+            start_node (launch, node);
+        }
+    }
+}
+
+/* starts all entries left, as soon as all their dependencies are ready, and
+ * (with socket activation) until all were started */
+void
+launch_run (launch_t *launch)
+{
+    int has_deps = 0;
+    int i;
+
+    for (i = 0; i < launch->len; ++i)
+    {
+        node_t *node = &launch->nodes[i];
+
+        if (node->entry->after)
+        {
+            add_deps (launch, node, node->entry->after, 0);
+        }
+        if (node->entry->requires)
+        {
+            add_deps (launch, node, node->entry->requires, 1);
+        }
+        has_deps |= (node->nb_deps > 0);
+    }
+    launch->resolved = 1;
+
+    /* entries started early were tracked just in case, no need if nobody
+     * waits on them */
+    for (i = 0; i < launch->len; ++i)
+    {
+        node_t *node = &launch->nodes[i];
+
+        if (node->state == NODE_STARTED && node->nb_dependents == 0)
+        {
+            node->state = NODE_READY;
+            if (node->notify_fd >= 0)
+            {
+                epoll_ctl (launch->epfd, EPOLL_CTL_DEL, node->notify_fd, NULL);
+                close (node->notify_fd);
+                node->notify_fd = -1;
+            }
+        }
+    }
+
+    if (has_deps)
+    {
+        check_cycles (launch);
+    }
+
+    while (!launch->stopping
+            && (start_nodes (launch) > 0 || launch->nb_listening > 0))
+    {
+        wait_events (launch);
+    }
+
+    if (launch->first_spawn >= 0)
+    {
+        p (LVL_VERBOSE, "time to first spawn: %ld.%03ld ms\n",
+                launch->first_spawn / 1000, launch->first_spawn % 1000);
+    }
+
+    if ((launch->track || launch->status_fd >= 0 || launch->account_window > 0)
+            && launch->sigfd >= 0)
+    {
+        track_nodes (launch);
+    }
+}
+
+/* samples resources used by applications for window seconds (since dapper
+ * started), then prints a report, as JSON if json is set */
+void
+launch_set_account (launch_t *launch, int window, int json)
+{
+    if (!launch->dry_run && launch->sigfd >= 0)
+    {
+        launch->account_window = (window > 0) ? window * 1000L : 1;
+        launch->account_json = json;
+    }
+}
+
+/* name wasn't to be started, because of reason; for status snapshots */
+void
+launch_skip (launch_t *launch, const char *name, const char *reason)
+{
+    if (!launch->status)
+    {
+        return;
+    }
+    launch->skipped = realloc (launch->skipped,
+            sizeof (*launch->skipped) * (size_t) (launch->nb_skipped + 1));
+    launch->skipped[launch->nb_skipped].name = strdup (name);
+    launch->skipped[launch->nb_skipped].reason = reason;
+    ++launch->nb_skipped;
+}
+
+/* whether name was to be started, but wasn't, e.g. because of a required
+ * dependency */
+int
+launch_not_started (launch_t *launch, const char *name)
+{
+    int i = find_node (launch, name, strlen (name));
+
+    return i >= 0 && launch->nodes[i].state == NODE_FAILED
+        && launch->nodes[i].spawn_pid == 0;
+}
+
+/* for backends: entry id notified it is ready */
+void
+launch_ready (launch_t *launch, int id)
+{
+    if (id >= 0 && id < launch->len && launch->nodes[id].state == NODE_STARTED)
+    {
+        set_state (launch, &launch->nodes[id], NODE_READY, "notified");
+    }
+}
+
+/* defers launches of non-critical entries while under pressure */
+void
+launch_set_gate (launch_t *launch, const gate_conf_t *conf)
+{
+    if (!launch->dry_run && launch->sigfd >= 0)
+    {
+        launch->gate = gate_new (conf, launch->epfd, EV_GATE);
+    }
+}
+
+/* defers launches of GUI entries until the display accepts connections, for up
+ * to timeout seconds */
+void
+launch_set_display (launch_t *launch, int timeout)
+{
+    if (!launch->dry_run && launch->sigfd >= 0)
+    {
+        launch->display = display_new (timeout, launch->epfd, EV_DISPLAY);
+    }
+}
+
+void
+launch_free (launch_t *launch)
+{
+    int i;
+
+    for (i = 0; i < launch->len; ++i)
+    {
+        if (launch->nodes[i].notify_fd >= 0)
+        {
+            close (launch->nodes[i].notify_fd);
+        }
+        if (launch->nodes[i].listen_fd >= 0)
+        {
+            close (launch->nodes[i].listen_fd);
+        }
+        free (launch->nodes[i].deps);
+        free (launch->nodes[i].required);
+    }
+    for (i = 0; i < launch->nb_skipped; ++i)
+    {
+        free (launch->skipped[i].name);
+    }
+    free (launch->skipped);
+    if (launch->status_fd >= 0)
+    {
+        close (launch->status_fd);
+        unlink (launch->status_path);
+    }
+    if (launch->gate)
+    {
+        gate_free (launch->gate);
+    }
+    if (launch->wheel)
+    {
+        wheel_free (launch->wheel);
+    }
+    if (launch->display)
+    {
+        display_free (launch->display);
+    }
+    if (launch->epfd >= 0)
+    {
+        close (launch->epfd);
+    }
+    if (launch->inotify_fd >= 0)
+    {
+        close (launch->inotify_fd);
+    }
+    if (launch->sigfd >= 0)
+    {
+        close (launch->sigfd);
+    }
+    sigprocmask (SIG_SETMASK, &launch->old_mask, NULL);
+    free (launch->nodes);
+    free (launch);
+}
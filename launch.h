@@ -0,0 +1,68 @@
+/**
+ * dapper - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * launch.h
+ * Copyright (C) 2012-2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of dapper.
+ *
+ * dapper is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * dapper is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * dapper. If not, see http://www.gnu.org/licenses/
+ */
+
+#ifndef __LAUNCH_H__
+#define __LAUNCH_H__
+
+#include "dapper.h"
+#include "prefetch.h"
+#include "gate.h"
+
+#include <time.h>
+
+typedef struct _launch_t launch_t;
+
+/* replaces fork/exec & waiting on events, e.g. to simulate launches. id is the
+ * index of the entry, in the order it was added */
+typedef struct
+{
+    void       *data;
+    /* returns 0 on success, -1 on failure */
+    int       (*spawn) (void *data, int id, entry_t *entry);
+    /* current time, in ms */
+    long long (*now)   (void *data);
+    /* waits up to timeout ms (-1 for no limit) for something to happen, e.g. a
+     * call to launch_ready(); returns -1 if nothing ever will */
+    int       (*wait)  (void *data, long long timeout);
+} launch_backend_t;
+
+/* flags for launch_new() */
+#define LAUNCH_DRY_RUN      (1 << 0)    /* only print what would be started */
+#define LAUNCH_TRACK        (1 << 1)    /* keep running, to stop all on SIGTERM */
+#define LAUNCH_STATUS       (1 << 2)    /* keep running, serving status snapshots */
+
+launch_t *launch_new  (prefetch_t *pf, int flags, const struct timespec *ts_start,
+                       const launch_backend_t *backend);
+void      launch_add  (launch_t *launch, entry_t *entry);
+void      launch_run  (launch_t *launch);
+void      launch_free (launch_t *launch);
+
+void      launch_set_gate (launch_t *launch, const gate_conf_t *conf);
+void      launch_set_account (launch_t *launch, int window, int json);
+void      launch_set_display (launch_t *launch, int timeout);
+void      launch_ready    (launch_t *launch, int id);
+void      launch_skip     (launch_t *launch, const char *name, const char *reason);
+int       launch_not_started (launch_t *launch, const char *name);
+
+int       launch_stop_tracked (void);
+
+#endif /* __LAUNCH_H__ */
@@ -26,36 +26,61 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <dirent.h>
 #include <sys/stat.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
 
 #include "config.h"
+#include "dapper.h"
+#include "queue.h"
+#include "bundle.h"
+#include "check.h"
+#include "running.h"
+#include "prefetch.h"
+#include "launch.h"
+#include "probe.h"
+#include "sim.h"
+#include "service.h"
+#include "runlock.h"
+#include "order.h"
+#include "sysindex.h"
+
+/* name of the entry for TerminalServer, that entries through TerminalClient
+ * are started after; not a valid .desktop name, so no conflict */
+#define TERM_SERVER     "@terminal-server"
 
 static char *desktop  = NULL;
 static char *term_cmd = NULL;
-static int   verbose  = 0;
+static char *term_server = NULL;        /* TerminalServer, with term_client */
+static char *term_client = NULL;
+static char *term_server_ready = NULL;  /* TerminalServerReadyFile */
 static int   dry_run  = 0;
-
-#define LVL_ERROR       -1
-#define LVL_NORMAL      0
-#define LVL_VERBOSE     1
-#define LVL_DEBUG       2
-
-#define p(level, ...)  do {             \
-    if (level == LVL_ERROR)             \
-    {                                   \
-        fprintf (stderr, __VA_ARGS__);  \
-    }                                   \
-    else if (verbose >= level)          \
-    {                                   \
-        fprintf (stdout, __VA_ARGS__);  \
-    }                                   \
-} while (0)
+static int   prefetch = 0;
+static int   ready_timeout = 5;
+static int   stop_timeout = 5;
+static int   track    = 0;
+static int   skip_running = 0;
+static int   status   = 0;
+static int   account  = 0;          /* 1: text report; 2: JSON */
+static int   account_window = 30;   /* in seconds */
+static int   probe_timeout = 1000; /* in ms */
+static int   wait_display = 0;
+static int   display_timeout = 30;  /* in seconds */
+static runlock_policy_t run_lock_policy = RUNLOCK_NONE;
+static runlock_t *run_lock = NULL;
+static int   physical_order = 0;   /* ReadOrder=physical */
+static const char *system_index = SYSINDEX_FILE;  /* "" to not use one */
+static gate_conf_t gate_conf = { "/proc/pressure", "/proc/meminfo", 0, 0, 0, 0, 30 };
+int          verbose  = 0;
 
 typedef enum {
     PARSE_OK        = 0,
@@ -74,6 +99,7 @@ typedef struct
 {
     char      *dir;
     dir_type_t type;
+    int        system;  /* from XDG_CONFIG_DIRS, i.e. in the system index */
 } dir_t;
 
 typedef struct
@@ -89,18 +115,68 @@ typedef struct _files_t
     struct _files_t *next;
 } files_t;
 
-typedef struct
+typedef struct _desktop_t
 {
-    char *icon;
-    int   hidden;
-    char *only_in;
-    char *not_in;
-    char *try_exec;
-    char *exec;
-    char *path;
-    int   terminal;
+    char    *name;
+    char    *file;
+    char    *data;          /* file content; all strings below point inside */
+    parse_t  state;
+    int      try_exec_state; /* 0: not checked yet; 1: found; -1: not found;
+                              * -2: probe timed out */
+    char    *icon;
+    int      hidden;
+    char    *only_in;
+    char    *not_in;
+    char    *try_exec;
+    char    *exec;
+    char    *path;
+    int      terminal;
+    char    *after;
+    char    *requires;
+    char    *ready_file;
+    int      ready_timeout; /* -1 if not set */
+    int      stop_timeout;  /* -1 if not set */
+    diag_t  *diags;         /* what went wrong, if anything */
+    char    *listen;
+    int      critical;
+    int      headless;
+    int      delay;         /* in seconds since login */
+    const char *skip;       /* why make_entry() returned NULL, if it did */
+    struct _desktop_t *next;
 } desktop_t;
 
+/* what to start applications for: a desktop (for OnlyShowIn/NotShowIn), and
+ * the command line prefix for Terminal=true (NULL to use term_cmd) */
+typedef struct
+{
+    char *name;
+    char *desktop;
+    char *term_cmd;
+} profile_t;
+
+typedef struct
+{
+    profile_t *profiles;
+    int        alloc;
+    int        len;
+} profiles_t;
+
+static profiles_t conf_profiles = { NULL, 0, 0 };
+
+/* long options without a short version */
+enum
+{
+    OPT_PACK = 256,
+    OPT_STOP,
+    OPT_SIMULATE,
+    OPT_LAUNCH,
+    OPT_SERVICE,
+    OPT_CLIENT,
+    OPT_RUN_LOCK,
+    OPT_READ_ORDER,
+    OPT_BUILD_INDEX,
+};
+
 static char *
 trim (char *str)
 {
@@ -289,7 +365,7 @@ split_exec (char *exec, int *argc, char ***argv, int *alloc)
                     --l;
                     if (l)
                     {
-                        memmove (exec, exec + 2, l + 1);
+                        memmove (exec, exec + 2, l);
                     }
                     else
                     {
@@ -350,7 +426,8 @@ split_exec (char *exec, int *argc, char ***argv, int *alloc)
                 {
                     *alloc += 10;
                     *argv = realloc (*argv, sizeof (**argv) * (size_t) *alloc);
-                    memset (*argv + *argc + 1, '\0', 10 * sizeof (**argv));
+                    memset (*argv + *argc + 1, '\0',
+                            sizeof (**argv) * (size_t) (*alloc - *argc - 1));
                 }
                 (*argv)[*argc] = exec + is_quoted;
                 if (is_quoted)
@@ -371,8 +448,42 @@ split_exec (char *exec, int *argc, char ***argv, int *alloc)
     }
 }
 
+/* returns the profile by that name (of length len), creating it if needed &
+ * create is set */
+static profile_t *
+get_profile (profiles_t *profiles, const char *name, size_t len, int create)
+{
+    profile_t *profile;
+    int        i;
+
+    for (i = 0; i < profiles->len; ++i)
+    {
+        if (strncmp (profiles->profiles[i].name, name, len) == 0
+                && profiles->profiles[i].name[len] == '\0')
+        {
+            return &profiles->profiles[i];
+        }
+    }
+    if (!create)
+    {
+        return NULL;
+    }
+
+    if (profiles->len == profiles->alloc)
+    {
+        profiles->alloc += 4;
+        profiles->profiles = realloc (profiles->profiles,
+                sizeof (*profiles->profiles) * (size_t) profiles->alloc);
+    }
+    profile = &profiles->profiles[profiles->len++];
+    profile->name = strndup (name, len);
+    profile->desktop = NULL;
+    profile->term_cmd = NULL;
+    return profile;
+}
+
 static int
-is_in_list (const char *name, char *items, char *item)
+is_in_list (const char *name, char *items, const char *item)
 {
     size_t len = strlen (items);
     char  *s;
@@ -396,6 +507,82 @@ is_in_list (const char *name, char *items, char *item)
     return 0;
 }
 
+/* returns the number in str (from 0 to max), or -1 */
+static int
+parse_number (const char *str, long max)
+{
+    char *e;
+    long  l;
+
+    errno = 0;
+    l = strtol (str, &e, 10);
+    if (errno || *str == '\0' || *e != '\0' || l < 0 || l > max)
+    {
+        return -1;
+    }
+    return (int) l;
+}
+
+/* returns the run lock policy in str, or -1 */
+static int
+parse_run_lock (const char *str)
+{
+    if (strcmp (str, "none") == 0)
+    {
+        return RUNLOCK_NONE;
+    }
+    else if (strcmp (str, "exit") == 0)
+    {
+        return RUNLOCK_EXIT;
+    }
+    else if (strcmp (str, "wait") == 0)
+    {
+        return RUNLOCK_WAIT;
+    }
+    else if (strcmp (str, "merge") == 0)
+    {
+        return RUNLOCK_MERGE;
+    }
+    return -1;
+}
+
+/* returns 1 for physical order, 0 for scan order, or -1 */
+static int
+parse_read_order (const char *str)
+{
+    if (strcmp (str, "scan") == 0)
+    {
+        return 0;
+    }
+    else if (strcmp (str, "physical") == 0)
+    {
+        return 1;
+    }
+    return -1;
+}
+
+/* returns the (non-negative) number of seconds in str, or -1 */
+static int
+parse_seconds (const char *str)
+{
+    return parse_number (str, 86400);
+}
+
+static void
+add_diag (desktop_t *d, int line, const char *kind)
+{
+    diag_t **dg;
+
+    for (dg = &d->diags; *dg; dg = &(*dg)->next)
+        ;
+    *dg = malloc (sizeof (**dg));
+    (*dg)->line = line;
+    (*dg)->kind = kind;
+    (*dg)->next = NULL;
+}
+
+static parse_t parse_data (int is_desktop, char *file, char *data, void *out);
+
 static parse_t
 parse_file (int is_desktop, char *file, char **data, size_t len_data, void *out)
 {
@@ -408,18 +595,50 @@ parse_file (int is_desktop, char *file, char **data, size_t len_data, void *out)
         if (errno == ENOENT)
         {
             p (LVL_VERBOSE, "%s: does not exists\n", file);
+            if (is_desktop)
+            {
+                add_diag (out, 0, "io");
+            }
             return PARSE_FILE_NOT_FOUND;
         }
         p (LVL_ERROR, "%s: unable to stat file\n", file);
+        if (is_desktop)
+        {
+            add_diag (out, 0, "io");
+        }
         return PARSE_FAILED;
     }
 
     if (!(fp = fopen (file, "r")))
     {
         p (LVL_ERROR, "%s: unable to open file\n", file);
+        if (is_desktop)
+        {
+            add_diag (out, 0, "io");
+        }
         return PARSE_FAILED;
     }
 
+    /* can we read the whole file in data, or do we need to allocate memory? */
+    if ((size_t) statbuf.st_size >= len_data)
+    {
+        /* +2: 1 for extra LF; 1 for NUL */
+        *data = malloc (sizeof (**data) * (size_t) (statbuf.st_size + 2));
+    }
+    **data = '\0'; /* in case the file is empty, so strcat works */
+    (*data)[statbuf.st_size] = '\0'; /* because fread won't put it */
+    p (LVL_DEBUG, "read file (%lu bytes)\n", statbuf.st_size);
+    fread (*data, (size_t) statbuf.st_size, 1, fp);
+    fclose (fp);
+    strcat (*data, "\n");
+
+    return parse_data (is_desktop, file, *data, out);
+}
+
+/* parses data, the content of file, which must end with a LF */
+static parse_t
+parse_data (int is_desktop, char *file, char *data, void *out)
+{
     desktop_t *d = NULL;
     size_t  l;
     char   *line;
@@ -428,6 +647,8 @@ parse_file (int is_desktop, char *file, char **data, size_t len_data, void *out)
     int     in_section  = 0;
     char   *key;
     char   *value;
+    char   *dot;
+    const char *err     = "value";
     parse_t state       = PARSE_OK;
 
     if (is_desktop)
@@ -435,21 +656,8 @@ parse_file (int is_desktop, char *file, char **data, size_t len_data, void *out)
         d = (desktop_t *) out;
     }
 
-    /* can we read the whole file in data, or do we need to allocate memory? */
-    if ((size_t) statbuf.st_size >= len_data)
-    {
-        /* +2: 1 for extra LF; 1 for NUL */
-        *data = malloc (sizeof (**data) * (size_t) (statbuf.st_size + 2));
-    }
-    **data = '\0'; /* in case the file is empty, so strcat works */
-    (*data)[statbuf.st_size] = '\0'; /* because fread won't put it */
-    p (LVL_DEBUG, "read file (%lu bytes)\n", statbuf.st_size);
-    fread (*data, (size_t) statbuf.st_size, 1, fp);
-    fclose (fp);
-    strcat (*data, "\n");
-
     /* now do the parsing */
-    line = *data;
+    line = data;
     p (LVL_DEBUG, "start parsing\n");
     while ((s = strchr (line, '\n')))
     {
@@ -475,6 +683,10 @@ parse_file (int is_desktop, char *file, char **data, size_t len_data, void *out)
             {
                 p (LVL_ERROR, "%s: syntax error (missing =) line %d\n",
                         file, line_nb);
+                if (d)
+                {
+                    add_diag (d, line_nb, "syntax");
+                }
                 goto next;
             }
 
@@ -492,6 +704,7 @@ parse_file (int is_desktop, char *file, char **data, size_t len_data, void *out)
                     {
                         p (LVL_ERROR, "%s: invalid type line %d: %s\n",
                                 file, line_nb, value);
+                        err = "type";
                         state = PARSE_FAILED;
                     }
                 }
@@ -574,6 +787,98 @@ parse_file (int is_desktop, char *file, char **data, size_t len_data, void *out)
                         state = PARSE_FAILED;
                     }
                 }
+                else if (strcmp (key, "X-Dapper-After") == 0)
+                {
+                    unesc (value);
+                    p (LVL_VERBOSE, "%s set to %s\n", key, value);
+                    d->after = value;
+                }
+                else if (strcmp (key, "X-Dapper-Requires") == 0)
+                {
+                    unesc (value);
+                    p (LVL_VERBOSE, "%s set to %s\n", key, value);
+                    d->requires = value;
+                }
+                else if (strcmp (key, "X-Dapper-ReadyFile") == 0)
+                {
+                    unesc (value);
+                    p (LVL_VERBOSE, "%s set to %s\n", key, value);
+                    d->ready_file = value;
+                }
+                else if (strcmp (key, "X-Dapper-Critical") == 0)
+                {
+                    if (strcmp (value, "true") == 0)
+                    {
+                        d->critical = 1;
+                        p (LVL_VERBOSE, "%s set to true\n", key);
+                    }
+                    else if (strcmp (value, "false") != 0)
+                    {
+                        p (LVL_ERROR, "%s: invalid value for %s line %d: %s\n",
+                                file, key, line_nb, value);
+                        state = PARSE_FAILED;
+                    }
+                }
+                else if (strcmp (key, "X-Dapper-Display") == 0)
+                {
+                    if (strcmp (value, "false") == 0)
+                    {
+                        d->headless = 1;
+                        p (LVL_VERBOSE, "%s set to false\n", key);
+                    }
+                    else if (strcmp (value, "true") != 0)
+                    {
+                        p (LVL_ERROR, "%s: invalid value for %s line %d: %s\n",
+                                file, key, line_nb, value);
+                        state = PARSE_FAILED;
+                    }
+                }
+                else if (strcmp (key, "X-Dapper-Listen") == 0)
+                {
+                    unesc (value);
+                    p (LVL_VERBOSE, "%s set to %s\n", key, value);
+                    d->listen = value;
+                }
+                else if (strcmp (key, "X-Dapper-ReadyTimeout") == 0)
+                {
+                    if ((d->ready_timeout = parse_seconds (value)) < 0)
+                    {
+                        p (LVL_ERROR, "%s: invalid value for %s line %d: %s\n",
+                                file, key, line_nb, value);
+                        state = PARSE_FAILED;
+                    }
+                    else
+                    {
+                        p (LVL_VERBOSE, "%s set to %d\n", key, d->ready_timeout);
+                    }
+                }
+                else if (strcmp (key, "X-Dapper-Delay") == 0
+                        || strcmp (key, "X-GNOME-Autostart-Delay") == 0)
+                {
+                    if ((d->delay = parse_seconds (value)) < 0)
+                    {
+                        p (LVL_ERROR, "%s: invalid value for %s line %d: %s\n",
+                                file, key, line_nb, value);
+                        state = PARSE_FAILED;
+                    }
+                    else
+                    {
+                        p (LVL_VERBOSE, "%s set to %d\n", key, d->delay);
+                    }
+                }
+                else if (strcmp (key, "X-Dapper-StopTimeout") == 0)
+                {
+                    if ((d->stop_timeout = parse_seconds (value)) < 0)
+                    {
+                        p (LVL_ERROR, "%s: invalid value for %s line %d: %s\n",
+                                file, key, line_nb, value);
+                        state = PARSE_FAILED;
+                    }
+                    else
+                    {
+                        p (LVL_VERBOSE, "%s set to %d\n", key, d->stop_timeout);
+                    }
+                }
             }
             else
             {
@@ -590,462 +895,2087 @@ parse_file (int is_desktop, char *file, char **data, size_t len_data, void *out)
                     p (LVL_VERBOSE, "set terminal command line prefix to: %s\n",
                             term_cmd);
                 }
-                else
+                else if (strcmp (key, "TerminalServer") == 0)
                 {
-                    p (LVL_ERROR, "%s: unknown option line %d: %s\n",
-                            file, line_nb, key);
-                    state = PARSE_FAILED;
+                    term_server = value;
+                    p (LVL_VERBOSE, "set terminal server command line to: %s\n",
+                            term_server);
                 }
-            }
-        }
-        else
-        {
-            p (LVL_DEBUG, "not in section Desktop Entry, done\n");
-            state = PARSE_ABORTED;
-        }
-next:
-        if (state != PARSE_OK)
-        {
-            p (LVL_DEBUG, "stop parsing\n");
-            break;
-        }
-        line = s + 1;
-    }
-    p (LVL_VERBOSE, "parsing completed\n");
-    return state;
-}
-
-static void
-process_file (char *file)
-{
-    const char *home            = getenv ("HOME");
-    size_t      len_home        = strlen (home);
-    char         buf[4096];
-    char        *data           = buf;
-    parse_t      state;
-    desktop_t    d;
-    char        *s;
-    char       **a = NULL;
-    char       **ptr_to_free    = NULL;
-    int          i;
-
-    p (LVL_DEBUG, "processing file: %s\n", file);
-    memset (&d, 0, sizeof (d));
-    state = parse_file (1, file, &data, 4096, &d);
-    if (state == PARSE_OK || (state == PARSE_ABORTED && d.hidden))
-    {
-        if (d.hidden)
-        {
-            p (LVL_VERBOSE, "no auto-start to perform\n");
-            if (data != buf)
-            {
-                free (data);
-            }
-            return;
-        }
-
-        if (desktop)
-        {
-            if (d.only_in && !is_in_list ("OnlyShowIn", d.only_in, desktop))
-            {
-                p (LVL_VERBOSE, "%s not in OnlyShowIn, no auto-start\n", desktop);
-                if (data != buf)
+                else if (strcmp (key, "TerminalClient") == 0)
                 {
-                    free (data);
+                    term_client = value;
+                    p (LVL_VERBOSE, "set terminal client command line prefix to: %s\n",
+                            term_client);
                 }
-                return;
-            }
-            else if (d.not_in && is_in_list ("NotShowIn", d.not_in, desktop))
-            {
-                p (LVL_VERBOSE, "%s in NotShowIn, no auto-start\n", desktop);
-                if (data != buf)
+                else if (strcmp (key, "TerminalServerReadyFile") == 0)
                 {
-                    free (data);
+                    term_server_ready = value;
+                    p (LVL_VERBOSE, "set terminal server ready file to: %s\n",
+                            term_server_ready);
                 }
-                return;
-            }
-        }
-        else if (d.only_in)
-        {
-            p (LVL_ERROR, "%s: OnlyShowIn set, desktop unknown, no auto-start\n",
-                    file);
-            if (data != buf)
-            {
-                free (data);
-            }
-            return;
-        }
-        else if (d.not_in)
-        {
-            p (LVL_ERROR, "%s: NotShowIn set, desktop unknown, no auto-start\n",
-                    file);
-            if (data != buf)
-            {
-                free (data);
-            }
-            return;
-        }
-
-        if (d.try_exec)
-        {
-            int try_state = 0;
-
-            /* expand ~ to $HOME? */
-            if (*d.try_exec == '~')
-            {
-                s = malloc (sizeof (*s) * (len_home + strlen (d.try_exec)));
-                sprintf (s, "%s%s", home, d.try_exec + 1);
-                p (LVL_DEBUG, "TryExec: checking %s\n", s);
-                if (access (s, F_OK | X_OK) == 0)
+                else if (strncmp (key, "Profile.", 8) == 0
+                        && (dot = strrchr (key, '.')) && dot > key + 8
+                        && (strcmp (dot, ".Desktop") == 0
+                            || strcmp (dot, ".Terminal") == 0))
                 {
-                    try_state = 1;
-                }
-                free (s);
-            }
-            /* is it an absolute path or not? */
-            else if (*d.try_exec != '/')
-            {
-                /* must search the PATH then */
-                char *path;
-                char *dir;
+                    profile_t *profile;
 
-                path = getenv ("PATH");
-                if (!path)
-                {
-                    p (LVL_VERBOSE, "%s: no PATH to find TryExec (%s), no auto-start\n",
-                            file, d.try_exec);
-                    if (data != buf)
+                    profile = get_profile (&conf_profiles, key + 8,
+                            (size_t) (dot - key - 8), 1);
+                    if (dot[1] == 'D')
+                    {
+                        profile->desktop = value;
+                        p (LVL_VERBOSE, "profile %s: set desktop to %s\n",
+                                profile->name, value);
+                    }
+                    else
                     {
-                        free (data);
+                        profile->term_cmd = value;
+                        p (LVL_VERBOSE, "profile %s: set terminal command line "
+                                "prefix to: %s\n", profile->name, value);
                     }
-                    return;
                 }
-                path = strdup (path);
-                dir = path;
-
-                for (;;)
+                else if (strcmp (key, "ReadyTimeout") == 0)
                 {
-                    char   buf2[1024];
-                    char  *b = buf2;
-                    size_t l;
-
-                    if ((s = strchr (dir, ':')))
+                    if ((ready_timeout = parse_seconds (value)) < 0)
                     {
-                        *s = '\0';
+                        p (LVL_ERROR, "%s: invalid value for %s line %d: %s\n",
+                                file, key, line_nb, value);
+                        state = PARSE_FAILED;
                     }
-                    l = strlen (dir) + strlen (d.try_exec) + 1; /* +1 == slash */
-                    if (l >= 1024)
+                    else
                     {
-                        b = malloc (sizeof (*b) * (l + 1));
+                        p (LVL_VERBOSE, "set ready timeout to %d\n", ready_timeout);
                     }
-                    sprintf (b, "%s/%s", dir, d.try_exec);
-                    p (LVL_DEBUG, "TryExec: checking %s\n", buf2);
-                    if (access (b, F_OK | X_OK) == 0)
+                }
+                else if (strcmp (key, "StopTimeout") == 0)
+                {
+                    if ((stop_timeout = parse_seconds (value)) < 0)
                     {
-                        if (b != buf2)
-                        {
-                            free (b);
-                        }
-                        try_state = 1;
-                        break;
+                        p (LVL_ERROR, "%s: invalid value for %s line %d: %s\n",
+                                file, key, line_nb, value);
+                        state = PARSE_FAILED;
                     }
-
-                    if (b != buf2)
+                    else
                     {
-                        free (b);
+                        p (LVL_VERBOSE, "set stop timeout to %d\n", stop_timeout);
                     }
+                }
+                else if (strcmp (key, "PressureCPU") == 0
+                        || strcmp (key, "PressureIO") == 0
+                        || strcmp (key, "PressureMemory") == 0)
+                {
+                    int *t = (key[8] == 'C') ? &gate_conf.cpu
+                        : (key[8] == 'I') ? &gate_conf.io : &gate_conf.memory;
 
-                    if (!s)
+                    if ((*t = parse_number (value, 100)) < 0)
                     {
-                        break;
+                        p (LVL_ERROR, "%s: invalid value for %s line %d: %s\n",
+                                file, key, line_nb, value);
+                        state = PARSE_FAILED;
+                    }
+                    else
+                    {
+                        p (LVL_VERBOSE, "set %s threshold to %d%%\n", key, *t);
+                    }
+                }
+                else if (strcmp (key, "MinMemAvailable") == 0)
+                {
+                    if ((gate_conf.mem_available = parse_number (value, 1 << 30)) < 0)
+                    {
+                        p (LVL_ERROR, "%s: invalid value for %s line %d: %s\n",
+                                file, key, line_nb, value);
+                        state = PARSE_FAILED;
+                    }
+                    else
+                    {
+                        p (LVL_VERBOSE, "set min. MemAvailable to %d MiB\n",
+                                gate_conf.mem_available);
+                    }
+                }
+                else if (strcmp (key, "GateTimeout") == 0)
+                {
+                    if ((gate_conf.timeout = parse_seconds (value)) < 0)
+                    {
+                        p (LVL_ERROR, "%s: invalid value for %s line %d: %s\n",
+                                file, key, line_nb, value);
+                        state = PARSE_FAILED;
+                    }
+                    else
+                    {
+                        p (LVL_VERBOSE, "set gate timeout to %d\n", gate_conf.timeout);
+                    }
+                }
+                else if (strcmp (key, "ProbeTimeout") == 0)
+                {
+                    if ((probe_timeout = parse_number (value, 60000)) < 0)
+                    {
+                        p (LVL_ERROR, "%s: invalid value for %s line %d: %s\n",
+                                file, key, line_nb, value);
+                        state = PARSE_FAILED;
+                    }
+                    else
+                    {
+                        p (LVL_VERBOSE, "set probe timeout to %d ms\n", probe_timeout);
+                    }
+                }
+                else if (strcmp (key, "PressureDir") == 0)
+                {
+                    gate_conf.dir = value;
+                    p (LVL_VERBOSE, "set pressure folder to %s\n", value);
+                }
+                else if (strcmp (key, "MemInfo") == 0)
+                {
+                    gate_conf.meminfo = value;
+                    p (LVL_VERBOSE, "set meminfo file to %s\n", value);
+                }
+                else if (strcmp (key, "AccountWindow") == 0)
+                {
+                    if ((account_window = parse_seconds (value)) < 0)
+                    {
+                        p (LVL_ERROR, "%s: invalid value for %s line %d: %s\n",
+                                file, key, line_nb, value);
+                        state = PARSE_FAILED;
+                    }
+                    else
+                    {
+                        p (LVL_VERBOSE, "set account window to %d\n", account_window);
+                    }
+                }
+                else if (strcmp (key, "WaitDisplay") == 0)
+                {
+                    if (strcmp (value, "true") == 0)
+                    {
+                        wait_display = 1;
+                        p (LVL_VERBOSE, "enable waiting for display\n");
+                    }
+                    else if (strcmp (value, "false") == 0)
+                    {
+                        wait_display = 0;
+                    }
+                    else
+                    {
+                        p (LVL_ERROR, "%s: invalid value for %s line %d: %s\n",
+                                file, key, line_nb, value);
+                        state = PARSE_FAILED;
+                    }
+                }
+                else if (strcmp (key, "DisplayTimeout") == 0)
+                {
+                    if ((display_timeout = parse_seconds (value)) < 0)
+                    {
+                        p (LVL_ERROR, "%s: invalid value for %s line %d: %s\n",
+                                file, key, line_nb, value);
+                        state = PARSE_FAILED;
+                    }
+                    else
+                    {
+                        p (LVL_VERBOSE, "set display timeout to %d\n", display_timeout);
+                    }
+                }
+                else if (strcmp (key, "RunLock") == 0)
+                {
+                    int policy;
+
+                    if ((policy = parse_run_lock (value)) < 0)
+                    {
+                        p (LVL_ERROR, "%s: invalid value for %s line %d: %s\n",
+                                file, key, line_nb, value);
+                        state = PARSE_FAILED;
+                    }
+                    else
+                    {
+                        run_lock_policy = (runlock_policy_t) policy;
+                        p (LVL_VERBOSE, "set run lock to %s\n", value);
+                    }
+                }
+                else if (strcmp (key, "SystemIndex") == 0)
+                {
+                    system_index = value;
+                    p (LVL_VERBOSE, "set system index to: %s\n", system_index);
+                }
+                else if (strcmp (key, "ReadOrder") == 0)
+                {
+                    if ((physical_order = parse_read_order (value)) < 0)
+                    {
+                        p (LVL_ERROR, "%s: invalid value for %s line %d: %s\n",
+                                file, key, line_nb, value);
+                        state = PARSE_FAILED;
+                    }
+                    else
+                    {
+                        p (LVL_VERBOSE, "set read order to %s\n", value);
+                    }
+                }
+                else if (strcmp (key, "StatusSocket") == 0)
+                {
+                    if (strcmp (value, "true") == 0)
+                    {
+                        status = 1;
+                        p (LVL_VERBOSE, "enable status socket\n");
+                    }
+                    else if (strcmp (value, "false") == 0)
+                    {
+                        status = 0;
+                    }
+                    else
+                    {
+                        p (LVL_ERROR, "%s: invalid value for %s line %d: %s\n",
+                                file, key, line_nb, value);
+                        state = PARSE_FAILED;
+                    }
+                }
+                else if (strcmp (key, "SkipRunning") == 0)
+                {
+                    if (strcmp (value, "true") == 0)
+                    {
+                        skip_running = 1;
+                        p (LVL_VERBOSE, "enable skipping running applications\n");
+                    }
+                    else if (strcmp (value, "false") == 0)
+                    {
+                        skip_running = 0;
+                    }
+                    else
+                    {
+                        p (LVL_ERROR, "%s: invalid value for %s line %d: %s\n",
+                                file, key, line_nb, value);
+                        state = PARSE_FAILED;
+                    }
+                }
+                else if (strcmp (key, "Prefetch") == 0)
+                {
+                    if (strcmp (value, "true") == 0)
+                    {
+                        prefetch = 1;
+                        p (LVL_VERBOSE, "enable prefetching\n");
+                    }
+                    else if (strcmp (value, "false") == 0)
+                    {
+                        prefetch = 0;
+                    }
+                    else
+                    {
+                        p (LVL_ERROR, "%s: invalid value for %s line %d: %s\n",
+                                file, key, line_nb, value);
+                        state = PARSE_FAILED;
                     }
-                    dir = s + 1;
                 }
-                free (path);
+                else
+                {
+                    p (LVL_ERROR, "%s: unknown option line %d: %s\n",
+                            file, line_nb, key);
+                    state = PARSE_FAILED;
+                }
+            }
+        }
+        else
+        {
+            p (LVL_DEBUG, "not in section Desktop Entry, done\n");
+            state = PARSE_ABORTED;
+        }
+next:
+        if (state == PARSE_FAILED && d)
+        {
+            add_diag (d, line_nb, err);
+        }
+        if (state != PARSE_OK)
+        {
+            p (LVL_DEBUG, "stop parsing\n");
+            break;
+        }
+        line = s + 1;
+    }
+    p (LVL_VERBOSE, "parsing completed\n");
+    return state;
+}
+
+/* where the pid of dapper --track (ext "pid", for dapper --stop), the status
+ * socket (ext "sock") or the run lock (ext "lock") is, for this session */
+int
+get_runtime_file (char *buf, size_t len, const char *ext)
+{
+    const char *dir = getenv ("XDG_RUNTIME_DIR");
+    const char *session = getenv ("XDG_SESSION_ID");
+    size_t      l;
+
+    if (!dir)
+    {
+        return 0;
+    }
+    if (session)
+    {
+        l = (size_t) snprintf (buf, len, "%s/dapper-%s.%s", dir, session, ext);
+    }
+    else
+    {
+        l = (size_t) snprintf (buf, len, "%s/dapper.%s", dir, ext);
+    }
+    return l < len;
+}
+
+/* creates a thread with all signals blocked: signals are handled through the
+ * signalfd of launch.c, which only gets those no thread has unblocked */
+int
+start_thread (pthread_t *thread, void *(*fn) (void *), void *arg)
+{
+    sigset_t mask;
+    sigset_t old_mask;
+    int      r;
+
+    sigfillset (&mask);
+    pthread_sigmask (SIG_BLOCK, &mask, &old_mask);
+    r = pthread_create (thread, NULL, fn, arg);
+    pthread_sigmask (SIG_SETMASK, &old_mask, NULL);
+    return r;
+}
+
+/* returns the full path (to be free-d) of executable name as found in PATH,
+ * or NULL; with errno set to ETIMEDOUT if some dirs couldn't be checked (slow
+ * mounts), else ENOENT */
+char *
+find_in_path (const char *name)
+{
+    char *path;
+    char *dir;
+    char *s;
+    char *found = NULL;
+    int   timedout = 0;
+    int   r;
+
+    if (!(path = getenv ("PATH")))
+    {
+        errno = ENOENT;
+        return NULL;
+    }
+    path = strdup (path);
+    dir = path;
+
+    for (;;)
+    {
+        char   buf[1024];
+        char  *b = buf;
+        size_t l;
+
+        if ((s = strchr (dir, ':')))
+        {
+            *s = '\0';
+        }
+        l = strlen (dir) + strlen (name) + 1; /* +1 == slash */
+        if (l >= 1024)
+        {
+            b = malloc (sizeof (*b) * (l + 1));
+        }
+        sprintf (b, "%s/%s", dir, name);
+        p (LVL_DEBUG, "checking %s\n", b);
+        if ((r = probe_access (b)) > 0)
+        {
+            found = strdup (b);
+            if (b != buf)
+            {
+                free (b);
+            }
+            break;
+        }
+        else if (r < 0)
+        {
+            timedout = 1;
+        }
+
+        if (b != buf)
+        {
+            free (b);
+        }
+
+        if (!s)
+        {
+            break;
+        }
+        dir = s + 1;
+    }
+    free (path);
+
+    if (!found)
+    {
+        errno = (timedout) ? ETIMEDOUT : ENOENT;
+    }
+    return found;
+}
+
+/* copies argv into one single memory block, so it can outlive all buffers
+ * it was pointing to and be free-d at once */
+static char **
+pack_argv (char **argv)
+{
+    char  **packed;
+    char   *s;
+    size_t  len = 0;
+    size_t  l;
+    int     n;
+
+    for (n = 0; argv[n]; ++n)
+    {
+        len += strlen (argv[n]) + 1;
+    }
+    packed = malloc (sizeof (*packed) * (size_t) (n + 1) + len);
+    s = (char *) (packed + n + 1);
+    for (n = 0; argv[n]; ++n)
+    {
+        l = strlen (argv[n]) + 1;
+        memcpy (s, argv[n], l);
+        packed[n] = s;
+        s += l;
+    }
+    packed[n] = NULL;
+
+    return packed;
+}
+
+/* whether s is a shell assignment, i.e. NAME=value */
+static int
+is_assignment (const char *s)
+{
+    if (!isalpha (*s) && *s != '_')
+    {
+        return 0;
+    }
+    for (++s; isalnum (*s) || *s == '_'; ++s)
+        ;
+    return *s == '=';
+}
+
+/* whether argv[0] is name, either as is or from /bin or /usr/bin */
+static int
+is_wrapper (const char *arg, const char *name)
+{
+    if (strncmp (arg, "/usr/bin/", 9) == 0)
+    {
+        arg += 9;
+    }
+    else if (strncmp (arg, "/bin/", 5) == 0)
+    {
+        arg += 5;
+    }
+    return strcmp (arg, name) == 0;
+}
+
+/* whether word is a reserved word or a builtin of the shell, i.e. what we
+ * couldn't simply exec */
+static int
+is_shell_keyword (const char *word)
+{
+    const char *special[] = { "if", "then", "else", "elif", "fi", "case", "esac",
+        "for", "select", "while", "until", "do", "done", "in", "function",
+        "time", ".", ":", "alias", "bg", "break", "cd", "command", "continue",
+        "eval", "exit", "export", "fg", "getopts", "hash", "jobs", "local",
+        "read", "readonly", "return", "set", "shift", "source", "times",
+        "trap", "type", "ulimit", "umask", "unalias", "unset", "wait", "exec",
+        NULL };
+    const char **sp;
+
+    for (sp = special; *sp; ++sp)
+    {
+        if (strcmp (word, *sp) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Exec lines like "env VAR=val app" or sh -c "app --flag" cost an extra exec,
+ * of env or a whole shell, before the actual app. When they're provably simple,
+ * we apply assignments & run the app ourselves instead; anything else is left
+ * untouched */
+static void
+unwrap_exec (entry_t *entry)
+{
+    char  **env;
+    char  **argv;
+    char  **packed;
+    char   *inner = NULL;
+    char  **words = NULL;
+    int     nb_words = -1;
+    int     alloc = 0;
+    int     nb_env;
+    int     i;
+
+    for (nb_env = 0; entry->env && entry->env[nb_env]; ++nb_env)
+        ;
+
+    if (is_wrapper (entry->argv[0], "env"))
+    {
+        argv = entry->argv + 1;
+    }
+    /* sh -c with nothing the shell would give a special meaning to, i.e. no
+     * quoting, expansion, redirection, etc */
+    else if ((is_wrapper (entry->argv[0], "sh") || is_wrapper (entry->argv[0], "dash"))
+            && entry->argv[1] && strcmp (entry->argv[1], "-c") == 0
+            && entry->argv[2] && !entry->argv[3]
+            && entry->argv[2][strspn (entry->argv[2],
+                "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz"
+                "0123456789 _-./,:@+=")] == '\0')
+    {
+        /* split_exec works in place */
+        inner = strdup (entry->argv[2]);
+        split_exec (inner, &nb_words, &words, &alloc);
+        if (!words)
+        {
+            free (inner);
+            return;
+        }
+        argv = words;
+    }
+    else
+    {
+        return;
+    }
+
+    /* leading assignments; anything else starting with a dash is an option
+     * (of env) we don't handle */
+    for (i = 0; argv[i] && is_assignment (argv[i]); ++i)
+        ;
+    if (!argv[i] || argv[i][0] == '-')
+    {
+        free (words);
+        free (inner);
+        return;
+    }
+    if (inner)
+    {
+        if (strcmp (argv[i], "exec") == 0 && argv[i + 1])
+        {
+            memmove (argv + i, argv + i + 1, sizeof (*argv) * (size_t) (nb_words - i + 1));
+        }
+        if (is_shell_keyword (argv[i]))
+        {
+            free (words);
+            free (inner);
+            return;
+        }
+    }
+
+    p (LVL_VERBOSE, "%s: running %s directly, without %s\n",
+            entry->name, argv[i], entry->argv[0]);
+    TRACE (unwrap, entry->name, entry->argv[0], argv[i]);
+
+    /* assignments are applied in order, after those of an outer wrapper */
+    env = calloc ((size_t) (nb_env + i + 1), sizeof (*env));
+    if (nb_env)
+    {
+        memcpy (env, entry->env, sizeof (*env) * (size_t) nb_env);
+    }
+    memcpy (env + nb_env, argv, sizeof (*env) * (size_t) i);
+    /* everything might point to the old blocks, so pack before freeing */
+    packed = pack_argv (env);
+    argv = pack_argv (argv + i);
+    free (env);
+    free (entry->env);
+    free (entry->argv);
+    entry->env = packed;
+    entry->argv = argv;
+    free (words);
+    free (inner);
+    /* in case of env & sh -c nested in one another */
+    unwrap_exec (entry);
+}
+
+/* parses the .desktop file; what was parsed is kept (whatever the result) so
+ * it can then be checked against each profile. If data isn't NULL, it is the
+ * content of the file (e.g. from a bundle) and is taken over */
+static desktop_t *
+parse_desktop (const char *name, char *file, char *data)
+{
+    desktop_t *d;
+
+    p (LVL_DEBUG, "processing file: %s\n", file);
+    TRACE (parse__start, file);
+    d = calloc (1, sizeof (*d));
+    d->name = strdup (name);
+    d->file = strdup (file);
+    d->ready_timeout = -1;
+    d->stop_timeout = -1;
+    if (data)
+    {
+        d->data = data;
+        d->state = parse_data (1, d->file, data, d);
+    }
+    else
+    {
+        d->state = parse_file (1, file, &d->data, 0, d);
+    }
+    TRACE (parse__end, file, (int) d->state);
+    if (d->state != PARSE_OK && !(d->state == PARSE_ABORTED && d->hidden))
+    {
+        p (LVL_VERBOSE, "parsing failed (%d), no auto-start\n", d->state);
+    }
+    return d;
+}
+
+static void
+free_desktop (desktop_t *d)
+{
+    diag_t *dg;
+
+    while ((dg = d->diags))
+    {
+        d->diags = dg->next;
+        free (dg);
+    }
+    free (d->name);
+    free (d->file);
+    free (d->data);
+    free (d);
+}
+
+/* returns 1 if TryExec was found & executable, 0 if not, -1 if the probe timed
+ * out (slow mount). The result doesn't depend on the profile, so it's only
+ * checked once */
+static int
+check_try_exec (desktop_t *d)
+{
+    const char *home = getenv ("HOME");
+    char       *s;
+    int         try_state = 0;
+
+    if (d->try_exec_state)
+    {
+        return (d->try_exec_state == -2) ? -1 : d->try_exec_state > 0;
+    }
+    TRACE (tryexec__start, d->name, d->try_exec);
+
+    /* expand ~ to $HOME? */
+    if (*d->try_exec == '~')
+    {
+        s = malloc (sizeof (*s) * (strlen (home) + strlen (d->try_exec)));
+        sprintf (s, "%s%s", home, d->try_exec + 1);
+        p (LVL_DEBUG, "TryExec: checking %s\n", s);
+        try_state = probe_access (s);
+        free (s);
+    }
+    /* is it an absolute path or not? */
+    else if (*d->try_exec != '/')
+    {
+        /* must search the PATH then */
+        if (!getenv ("PATH"))
+        {
+            p (LVL_VERBOSE, "%s: no PATH to find TryExec (%s)\n",
+                    d->file, d->try_exec);
+        }
+        else if ((s = find_in_path (d->try_exec)))
+        {
+            try_state = 1;
+            free (s);
+        }
+        else if (errno == ETIMEDOUT)
+        {
+            try_state = -1;
+        }
+    }
+    else
+    {
+        p (LVL_DEBUG, "TryExec: checking %s\n", d->try_exec);
+        try_state = probe_access (d->try_exec);
+    }
+
+    if (try_state > 0)
+    {
+        p (LVL_DEBUG, "TryExec: found & executable\n");
+    }
+    d->try_exec_state = (try_state > 0) ? 1 : (try_state < 0) ? -2 : -1;
+    TRACE (tryexec__end, d->name, try_state);
+    return try_state;
+}
+
+/* for --check: parses file, and makes sure its command line can be used */
+static diag_t *
+check_file (const char *file)
+{
+    desktop_t *d;
+    diag_t    *diags;
+    char      *exec;
+    char      *s;
+    char     **argv = NULL;
+    int        argc = -1;
+    int        alloc = 0;
+    int        need_free;
+
+    d = parse_desktop (strrchr (file, '/') + 1, (char *) file, NULL);
+    if (d->state == PARSE_OK)
+    {
+        if (!d->exec)
+        {
+            add_diag (d, 0, "exec");
+        }
+        else
+        {
+            exec = s = strdup (d->exec);
+            need_free = replace_fields (&s, d->icon, NULL, d->file);
+            split_exec (s, &argc, &argv, &alloc);
+            if (!argv)
+            {
+                add_diag (d, 0, "exec");
+            }
+            free (argv);
+            if (need_free)
+            {
+                free (s);
+            }
+            free (exec);
+        }
+    }
+
+    diags = d->diags;
+    d->diags = NULL;
+    free_desktop (d);
+    return diags;
+}
+
+/* checks whether d is to be auto-started for profile, and if so returns the
+ * entry to start */
+static entry_t *
+make_entry (desktop_t *d, profile_t *profile)
+{
+    const char *home            = getenv ("HOME");
+    size_t      len_home        = strlen (home);
+    const char *dsk             = profile->desktop;
+    char       *tcmd            = (profile->term_cmd) ? profile->term_cmd : term_cmd;
+    int         through_server  = 0;
+    char        *s;
+    char       **a = NULL;
+    char       **ptr_to_free    = NULL;
+    entry_t     *entry          = NULL;
+    int          i;
+
+    d->skip = NULL;
+    if (d->state != PARSE_OK)
+    {
+        /* either parsing failed, or Hidden was set */
+        if (d->hidden)
+        {
+            p (LVL_VERBOSE, "%s: no auto-start to perform\n", d->name);
+        }
+        d->skip = (d->hidden) ? "Hidden" : "parse";
+        TRACE (filter, d->name, d->skip, 0);
+        return NULL;
+    }
+
+    if (dsk)
+    {
+        if (d->only_in && !is_in_list ("OnlyShowIn", d->only_in, dsk))
+        {
+            p (LVL_VERBOSE, "%s: %s not in OnlyShowIn, no auto-start\n",
+                    d->name, dsk);
+            d->skip = "OnlyShowIn";
+            TRACE (filter, d->name, d->skip, 0);
+            return NULL;
+        }
+        else if (d->not_in && is_in_list ("NotShowIn", d->not_in, dsk))
+        {
+            p (LVL_VERBOSE, "%s: %s in NotShowIn, no auto-start\n",
+                    d->name, dsk);
+            d->skip = "NotShowIn";
+            TRACE (filter, d->name, d->skip, 0);
+            return NULL;
+        }
+    }
+    else if (d->only_in)
+    {
+        p (LVL_ERROR, "%s: OnlyShowIn set, desktop unknown, no auto-start\n",
+                d->file);
+        d->skip = "OnlyShowIn";
+        TRACE (filter, d->name, d->skip, 0);
+        return NULL;
+    }
+    else if (d->not_in)
+    {
+        p (LVL_ERROR, "%s: NotShowIn set, desktop unknown, no auto-start\n",
+                d->file);
+        d->skip = "NotShowIn";
+        TRACE (filter, d->name, d->skip, 0);
+        return NULL;
+    }
+
+    if (d->try_exec && (i = check_try_exec (d)) <= 0)
+    {
+        if (i < 0)
+        {
+            p (LVL_ERROR, "%s: TryExec probe timed out (%s), no auto-start\n",
+                    d->file, d->try_exec);
+        }
+        else
+        {
+            p (LVL_VERBOSE, "%s: unable to find executable TryExec (%s), "
+                    "no autostart\n",
+                    d->file, d->try_exec);
+        }
+        d->skip = "TryExec";
+        TRACE (filter, d->name, d->skip, 0);
+        return NULL;
+    }
+
+    int    need_free;
+    char  *exec;
+    char  *term     = NULL;
+    char **argv     = NULL;
+    int    argc     = -1;
+    int    alloc    = 0;
+
+    if (!d->exec)
+    {
+        p (LVL_ERROR, "%s: no Exec defined, no auto-start\n", d->file);
+        d->skip = "Exec";
+        TRACE (filter, d->name, d->skip, 0);
+        return NULL;
+    }
+
+    p (LVL_VERBOSE, "%s: triggering auto-start\n", d->file);
+    TRACE (filter, d->name, "start", 1);
+
+    /* split_exec works in place, and we might need it for another profile */
+    exec = s = strdup (d->exec);
+    need_free = replace_fields (&s, d->icon, NULL, d->file);
+
+    if (d->terminal)
+    {
+        /* a profile's own prefix is for another terminal */
+        if (term_server && term_client && !profile->term_cmd)
+        {
+            tcmd = term_client;
+            through_server = 1;
+        }
+        if (tcmd)
+        {
+            /* split_exec works in place, and it's used for all entries */
+            term = strdup (tcmd);
+            split_exec (term, &argc, &argv, &alloc);
+        }
+        if (!argv)
+        {
+            p (LVL_ERROR, "%s: error with terminal command line: %s\n",
+                    d->file, tcmd);
+            d->skip = "Exec";
+            free (term);
+            if (need_free)
+            {
+                free (s);
+            }
+            free (exec);
+            return NULL;
+        }
+    }
+
+    split_exec (s, &argc, &argv, &alloc);
+    if (!argv)
+    {
+        p (LVL_ERROR, "%s: error processing command line\n", d->file);
+        d->skip = "Exec";
+        free (term);
+        if (need_free)
+        {
+            free (s);
+        }
+        free (exec);
+        return NULL;
+    }
+
+    /* expand ~ to $HOME */
+    if (home)
+    {
+        for (i = 0; i <= argc; ++i)
+        {
+            /* should we expand the ~ for $HOME */
+            if (argv[i][0] == '~')
+            {
+                if (!ptr_to_free)
+                {
+                    /* alloc ptr_to_free to contain enough if all argv left
+                     * will need expansion; +1 to be NULL-terminated */
+                    ptr_to_free = calloc ((size_t) (argc - i + 2),
+                            sizeof (*ptr_to_free));
+                    a = ptr_to_free;
+                }
+                *a = malloc (sizeof (**a) * (len_home + strlen (argv[i])));
+                sprintf (*a, "%s%s", home, argv[i] + 1);
+                /* replace pointer in argv */
+                argv[i] = *a;
+                ++a;
+            }
+        }
+    }
+
+    if (verbose >= LVL_DEBUG)
+    {
+        for (i = 0; i <= argc; ++i)
+        {
+            p (LVL_DEBUG, "argv[%d]=%s\n", i, argv[i]);
+        }
+    }
+
+    entry = calloc (1, sizeof (*entry));
+    entry->name = strdup (d->name);
+    entry->file = strdup (d->file);
+    entry->argv = pack_argv (argv);
+    unwrap_exec (entry);
+    entry->terminal = through_server;
+    if (through_server)
+    {
+        /* +2: ';' and NULL */
+        entry->after = malloc (sizeof (*entry->after)
+                * (strlen (TERM_SERVER) + ((d->after) ? strlen (d->after) : 0) + 2));
+        sprintf (entry->after, "%s%s%s", TERM_SERVER,
+                (d->after) ? ";" : "", (d->after) ? d->after : "");
+    }
+    else if (d->after)
+    {
+        entry->after = strdup (d->after);
+    }
+    if (d->requires)
+    {
+        entry->requires = strdup (d->requires);
+    }
+    if (d->ready_file)
+    {
+        if (*d->ready_file == '~' && home)
+        {
+            entry->ready_file = malloc (sizeof (*entry->ready_file)
+                    * (len_home + strlen (d->ready_file)));
+            sprintf (entry->ready_file, "%s%s", home, d->ready_file + 1);
+        }
+        else
+        {
+            entry->ready_file = strdup (d->ready_file);
+        }
+    }
+    entry->ready_timeout = (d->ready_timeout >= 0) ? d->ready_timeout : ready_timeout;
+    entry->stop_timeout = (d->stop_timeout >= 0) ? d->stop_timeout : stop_timeout;
+    entry->critical = d->critical;
+    entry->headless = d->headless;
+    entry->delay = d->delay;
+    if (d->listen)
+    {
+        const char *runtime_dir = getenv ("XDG_RUNTIME_DIR");
+
+        /* relative paths are relative to XDG_RUNTIME_DIR */
+        if (*d->listen == '~' && home)
+        {
+            entry->listen = malloc (sizeof (*entry->listen)
+                    * (len_home + strlen (d->listen)));
+            sprintf (entry->listen, "%s%s", home, d->listen + 1);
+        }
+        else if (*d->listen == '/')
+        {
+            entry->listen = strdup (d->listen);
+        }
+        else if (runtime_dir)
+        {
+            entry->listen = malloc (sizeof (*entry->listen)
+                    * (strlen (runtime_dir) + strlen (d->listen) + 2));
+            sprintf (entry->listen, "%s/%s", runtime_dir, d->listen);
+        }
+        else
+        {
+            p (LVL_ERROR, "%s: XDG_RUNTIME_DIR not set, ignoring X-Dapper-Listen\n",
+                    d->file);
+        }
+    }
+
+    /* free pointer(s) alloc-ed to expand ~ */
+    if (ptr_to_free)
+    {
+        for (a = ptr_to_free; *a; ++a)
+        {
+            free (*a);
+        }
+        free (ptr_to_free);
+    }
+    free (argv);
+    free (term);
+    if (need_free)
+    {
+        free (s);
+    }
+    free (exec);
+
+    return entry;
+}
+
+/* returns the entry for TerminalServer, to be started (once) before the first
+ * one through TerminalClient, or NULL */
+static entry_t *
+make_term_server (void)
+{
+    const char *home = getenv ("HOME");
+    const char *runtime_dir = getenv ("XDG_RUNTIME_DIR");
+    const char *ready = term_server_ready;
+    entry_t    *entry;
+    char       *s;
+    char      **argv    = NULL;
+    int         argc    = -1;
+    int         alloc   = 0;
+
+    /* split_exec works in place */
+    s = strdup (term_server);
+    split_exec (s, &argc, &argv, &alloc);
+    if (!argv)
+    {
+        p (LVL_ERROR, "error with terminal server command line: %s\n", term_server);
+        free (s);
+        return NULL;
+    }
+
+    entry = calloc (1, sizeof (*entry));
+    entry->name = strdup (TERM_SERVER);
+    entry->file = strdup ("TerminalServer");
+    entry->argv = pack_argv (argv);
+    unwrap_exec (entry);
+    entry->ready_timeout = ready_timeout;
+    entry->stop_timeout = stop_timeout;
+    /* as for X-Dapper-Listen, relative paths are relative to XDG_RUNTIME_DIR */
+    if (ready && *ready == '~' && home)
+    {
+        entry->ready_file = malloc (sizeof (*entry->ready_file)
+                * (strlen (home) + strlen (ready)));
+        sprintf (entry->ready_file, "%s%s", home, ready + 1);
+    }
+    else if (ready && *ready == '/')
+    {
+        entry->ready_file = strdup (ready);
+    }
+    else if (ready && runtime_dir)
+    {
+        entry->ready_file = malloc (sizeof (*entry->ready_file)
+                * (strlen (runtime_dir) + strlen (ready) + 2));
+        sprintf (entry->ready_file, "%s/%s", runtime_dir, ready);
+    }
+    else if (ready)
+    {
+        p (LVL_ERROR, "XDG_RUNTIME_DIR not set, ignoring TerminalServerReadyFile\n");
+    }
+
+    free (argv);
+    free (s);
+    return entry;
+}
+
+static void
+free_entry (entry_t *entry)
+{
+    free (entry->name);
+    free (entry->file);
+    free (entry->argv);
+    free (entry->env);
+    free (entry->after);
+    free (entry->requires);
+    free (entry->ready_file);
+    free (entry->listen);
+    free (entry->cmd_key);
+    free (entry);
+}
+
+static void
+add_dir (dirs_t *dirs, char *dir, dir_type_t type)
+{
+    int     i;
+    size_t  l;
+    char   *s;
+
+    l = strlen (dir);
+    if (type == DIR_ADD_SUFFIX)
+    {
+        /* 11 = strlen ("/autostart") + 1 for NULL */
+        s = malloc (sizeof (*s) * (l + 11));
+        sprintf (s, "%s%sautostart", dir, dir[l - 1] == '/' ? "" : "/");
+        if (dir[l - 1] != '/')
+        {
+            ++l;
+        }
+        l += 9; /* 9 = strlen ("autostart") */
+        dir = s;
+    }
+
+    if (l && dir[l - 1] == '/')
+    {
+        dir[l - 1] = '\0';
+    }
+
+    /* make sure this dir hasn't been processed already */
+    for (i = 0; i < dirs->len; ++i)
+    {
+        if (strcmp (dirs->dirs[i].dir, dir) == 0)
+        {
+            p (LVL_DEBUG, "%s: already listed, skipping\n", dir);
+            if (type == DIR_ADD_SUFFIX || type == DIR_NEEDS_FREE)
+            {
+                free ((char *) dir);
+            }
+            return;
+        }
+    }
+    if (dirs->len == dirs->alloc)
+    {
+        dirs->alloc += 10;
+        dirs->dirs = realloc (dirs->dirs, sizeof (*dirs->dirs) * (size_t) dirs->alloc);
+    }
+    p (LVL_DEBUG, "adding folder: %s\n", dir);
+    dirs->dirs[dirs->len].dir = (char *) dir;
+    dirs->dirs[dirs->len].system = 0;
+    dirs->dirs[dirs->len++].type = type;
+}
+
+static void
+add_system_dirs (dirs_t *dirs)
+{
+    char *dir;
+    char *s;
+    char *ss;
+    int   first = dirs->len;
+
+    p (LVL_DEBUG, "add system dirs\n");
+    if ((s = getenv ("XDG_CONFIG_DIRS")))
+    {
+        p (LVL_VERBOSE, "XDG_CONFIG_DIRS set to %s\n", s);
+        dir = s = strdup (s);
+        while ((ss = strchr (dir, ':')))
+        {
+            *ss = '\0';
+            add_dir (dirs, dir, DIR_ADD_SUFFIX);
+            dir = ss + 1;
+        }
+        add_dir (dirs, dir, DIR_ADD_SUFFIX);
+        free (s);
+    }
+    /* not defined, use default */
+    else
+    {
+        p (LVL_VERBOSE, "XDG_CONFIG_DIRS not set, using default: /etc/xdg\n");
+        add_dir (dirs, (char *) "/etc/xdg/autostart", DIR_CONST);
+    }
+    for ( ; first < dirs->len; ++first)
+    {
+        dirs->dirs[first].system = 1;
+    }
+}
+
+static int
+load_conf (char **data)
+{
+    int          ret = 0;
+    const char  *home = getenv ("HOME");
+    char        *file;
+    char         buf[2048];
+    size_t       len;
+
+    if (!home)
+    {
+        p (LVL_ERROR, "cannot load configuration: unable to get HOME path\n");
+        return ret;
+    }
+
+    len = (size_t) snprintf (buf, 2048, "%s/.config/dapper.conf", home);
+    if (len < 2048)
+    {
+        file = buf;
+    }
+    else
+    {
+        file = malloc (sizeof (*file) * (len + 1));
+        sprintf (file, "%s/.config/dapper.conf", home);
+    }
+
+    p (LVL_VERBOSE, "loading config from %s\n", file);
+    TRACE (conf__load__start, file);
+    ret = parse_file (0, file, data, 0, NULL);
+    ret = (ret == PARSE_OK || ret == PARSE_FILE_NOT_FOUND);
+    TRACE (conf__load__end, file, ret);
+    p (LVL_VERBOSE, "\n");
+
+    if (file != buf)
+    {
+        free (file);
+    }
+
+    return ret;
+}
+
+static void
+show_help (void)
+{
+    fprintf (stdout, PACKAGE_NAME " - Desktop Applications Autostarter v" PACKAGE_VERSION "\n");
+    fprintf (stdout, "\n");
+    fprintf (stdout, " -h, --help               Show this help screen and exit\n");
+    fprintf (stdout, " -V, --version            Show version information and exit\n");
+    fprintf (stdout, " -s, --system-dirs        Process autostart from system folders\n");
+    fprintf (stdout, " -u, --user-dir           Process autostart from user folder\n");
+    fprintf (stdout, " -e, --extra-dir PATH     Process autostart from PATH\n");
+    fprintf (stdout, " -d, --desktop DESKTOP    Start applications for DESKTOP\n");
+    fprintf (stdout, " -P, --profile PROFILE    Start applications for PROFILE\n");
+    fprintf (stdout, " -t, --terminal CMDLINE   Use CMDLINE as prefix for terminal mode\n");
+    fprintf (stdout, " -v, --verbose            Verbose mode (twice for debug mode)\n");
+    fprintf (stdout, " -n, --dry-run            Do not actually start anything\n");
+    fprintf (stdout, " -p, --prefetch           Prefetch executables & libraries before starting\n");
+    fprintf (stdout, " -R, --skip-running       Do not start applications already running\n");
+    fprintf (stdout, " -T, --track              Keep running, to stop applications on SIGTERM\n");
+    fprintf (stdout, " -S, --status-socket      Keep running, serving status on a socket\n");
+    fprintf (stdout, " -A, --account FORMAT     Report resources used by applications (text or json)\n");
+    fprintf (stdout, " -W, --wait-display       Wait for the display to be ready before GUI launches\n");
+    fprintf (stdout, "     --stop               Stop applications of the running dapper --track\n");
+    fprintf (stdout, "     --pack DIR OUT       Pack .desktop files from DIR into bundle OUT\n");
+    fprintf (stdout, " -c, --check              Check all .desktop files (recursively), start nothing\n");
+    fprintf (stdout, "     --simulate MODEL     Simulate launch strategies using cost MODEL, start nothing\n");
+    fprintf (stdout, "     --launch NAME        Only process NAME[.desktop], without scanning folders\n");
+    fprintf (stdout, "     --service            Keep running, serving requests from --client\n");
+    fprintf (stdout, "     --client             Have the running --service do the work\n");
+    fprintf (stdout, "     --run-lock POLICY    If run already in this session: exit, wait or merge\n");
+    fprintf (stdout, "     --read-order ORDER   Read files in scan or physical (on disk) order\n");
+    fprintf (stdout, "     --build-system-index Index system folders, for all users to share\n");
+    exit (0);
+}
+
+static void
+show_version (void)
+{
+    fprintf (stdout, PACKAGE_NAME " - Desktop Applications Autostarter v" PACKAGE_VERSION "\n");
+    fprintf (stdout, "Copyright (C) 2012-2013 Olivier Brunel\n");
+    fprintf (stdout, "License GPLv3+: GNU GPL version 3 or later <http://gnu.org/licenses/gpl.html>\n");
+    fprintf (stdout, "This is free software: you are free to change and redistribute it.\n");
+    fprintf (stdout, "There is NO WARRANTY, to the extent permitted by law.\n");
+    exit (0);
+}
+
+/* scanning, parsing & starting are done on their own thread, each stage
+ * handing items over to the next one as soon as they're ready, so the first
+ * application can be started before we're done reading all dirs */
+typedef struct
+{
+    dirs_t    *dirs;
+    files_t   *files;       /* names processed so far (precedence) */
+    queue_t    scanned;     /* scanned_t items: .desktop files to parse */
+    queue_t    parsed;      /* entries to start (only with one profile) */
+    profile_t *profile;     /* NULL when there are multiple profiles */
+    const char *name;       /* only look for this file (--launch) */
+    desktop_t *desktops;
+    desktop_t *last_desktop;
+} pipeline_t;
+
+/* a .desktop file to be parsed */
+typedef struct
+{
+    char *file;     /* full path */
+    char *data;     /* content (from a bundle), NULL to read file */
+} scanned_t;
+
+/* queues file name from dir to be parsed, unless a file of the same name was
+ * already processed (from a previous dir). If data isn't NULL, it's the
+ * content of the file, of len bytes */
+static void
+scan_file (pipeline_t *pl, const char *dir, const char *name,
+           const char *data, size_t len)
+{
+    files_t   *f;
+    files_t   *last = NULL;
+    files_t   *file;
+    scanned_t *item;
+
+    for (f = pl->files; f; f = f->next)
+    {
+        last = f;
+        if (strcmp (name, f->name) == 0)
+        {
+            p (LVL_VERBOSE, "\n%s: name already processed, ignoring\n", name);
+            return;
+        }
+    }
+
+    p (LVL_VERBOSE, "\n%s: processing\n", name);
+
+    file = malloc (sizeof (*file));
+    file->name = strdup (name);
+    file->next = NULL;
+
+    item = malloc (sizeof (*item));
+    /* +2: '/' and NULL */
+    item->file = malloc (sizeof (*item->file) * (strlen (dir) + strlen (name) + 2));
+    sprintf (item->file, "%s/%s", dir, name);
+    item->data = NULL;
+    if (data)
+    {
+        /* +2: 1 for extra LF; 1 for NUL, as parse_data() expects */
+        item->data = malloc (sizeof (*item->data) * (len + 2));
+        memcpy (item->data, data, len);
+        item->data[len] = '\n';
+        item->data[len + 1] = '\0';
+    }
+    queue_push (&pl->scanned, item);
+
+    /* if we have a list, update the next pointer of the last item (l),
+     * else this becomes the first item of the list */
+    if (pl->files && last)
+    {
+        last->next = file;
+    }
+    else
+    {
+        pl->files = file;
+    }
+}
+
+/* returns the number of files queued, i.e. whether pl->name was found */
+static int
+scan_bundle (pipeline_t *pl, const char *path)
+{
+    bundle_t   *bundle;
+    const char *data;
+    size_t      len;
+    int         nb = 0;
+    int         i;
+
+    if (!(bundle = bundle_open (path)))
+    {
+        return 0;
+    }
+    p (LVL_VERBOSE, "open bundle %s\n", path);
+    for (i = 0; i < bundle_len (bundle); ++i)
+    {
+        if (pl->name && strcmp (pl->name, bundle_name (bundle, i)) != 0)
+        {
+            continue;
+        }
+        data = bundle_data (bundle, i, &len);
+        scan_file (pl, path, bundle_name (bundle, i), data, len);
+        ++nb;
+    }
+    p (LVL_VERBOSE, "\nclosing bundle\n");
+    bundle_close (bundle);
+    return nb;
+}
+
+/* for --launch: looks for pl->name in dir directly, without reading it all.
+ * Returns 1 if found, i.e. it's the one to process */
+static int
+scan_name (pipeline_t *pl, const char *dir)
+{
+    struct stat statbuf;
+    int         dfd;
+    int         fd;
+
+    p (LVL_VERBOSE, "look for %s in %s\n", pl->name, dir);
+    if ((dfd = open (dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+    {
+        if (errno == ENOTDIR)
+        {
+            return scan_bundle (pl, dir) > 0;
+        }
+        else if (errno != ENOENT)
+        {
+            p (LVL_ERROR, "failed to open %s\n", dir);
+        }
+        return 0;
+    }
+    fd = openat (dfd, pl->name, O_RDONLY | O_CLOEXEC);
+    close (dfd);
+    if (fd < 0)
+    {
+        if (errno == ENOENT)
+        {
+            return 0;
+        }
+        /* it is there, so it's the one; parsing will report the error */
+        scan_file (pl, dir, pl->name, NULL, 0);
+        return 1;
+    }
+    if (fstat (fd, &statbuf) < 0 || !S_ISREG (statbuf.st_mode))
+    {
+        /* ignored, as when scanning */
+        close (fd);
+        return 0;
+    }
+    close (fd);
+    scan_file (pl, dir, pl->name, NULL, 0);
+    return 1;
+}
+
+/* for ReadOrder=physical: lists all .desktop files (skipping ones overridden
+ * by a previous dir or bundle) & bundles, and reads them ahead in the order
+ * they are on disk. Processing then happens as usual, in scan order,
+ * only from the page cache. The nb_indexed dirs from first on are skipped, as
+ * processed from the system index */
+static void
+read_ahead_dirs (const dirs_t *dirs, int first, int nb_indexed)
+{
+    const char   **files = NULL;
+    ino_t         *inos = NULL;
+    char         **bundled = NULL;  /* names of files in bundles */
+    int            alloc = 0;
+    int            nb = 0;
+    int            nb_bundled = 0;
+    int            i;
+    int            j;
+
+    for (i = 0; i < dirs->len; ++i)
+    {
+        DIR           *dp;
+        struct dirent *dirent;
+        const char    *dir = dirs->dirs[i].dir;
+        const char    *name;
+        char          *file;
+        ino_t          ino;
+        size_t         l;
+        int            overridden;
+
+        if (i >= first && i < first + nb_indexed)
+        {
+            continue;
+        }
+        dp = opendir (dir);
+        if (!dp && errno != ENOTDIR)
+        {
+            continue;
+        }
+        /* a bundle is itself the file to read */
+        dirent = NULL;
+        while (!dp || (dirent = readdir (dp)))
+        {
+            if (dp)
+            {
+                name = dirent->d_name;
+                ino = dirent->d_ino;
+                l = strlen (name);
+                /* as in scan_dirs(); 8 == strlen (".desktop") */
+                if (!(dirent->d_type & DT_REG) || l < 8
+                        || strcmp (".desktop", &name[l - 8]) != 0)
+                {
+                    continue;
+                }
+                /* overridden by a previous dir or bundle, won't be read */
+                overridden = 0;
+                for (j = 0; !overridden && j < nb; ++j)
+                {
+                    overridden = (strcmp (strrchr (files[j], '/') + 1, name) == 0);
+                }
+                for (j = 0; !overridden && j < nb_bundled; ++j)
+                {
+                    overridden = (strcmp (bundled[j], name) == 0);
+                }
+                if (overridden)
+                {
+                    continue;
+                }
+                /* +2: '/' and NULL */
+                file = malloc (sizeof (*file) * (strlen (dir) + l + 2));
+                sprintf (file, "%s/%s", dir, name);
             }
             else
             {
-                p (LVL_DEBUG, "TryExec: checking %s\n", d.try_exec);
-                if (access (d.try_exec, F_OK | X_OK) == 0)
+                bundle_t *bundle = bundle_open (dir);
+
+                if (!bundle)
+                {
+                    break;
+                }
+                bundled = realloc (bundled, sizeof (*bundled)
+                        * (size_t) (nb_bundled + bundle_len (bundle)));
+                for (j = 0; j < bundle_len (bundle); ++j)
                 {
-                    try_state = 1;
+                    bundled[nb_bundled++] = strdup (bundle_name (bundle, j));
                 }
+                bundle_close (bundle);
+                file = strdup (dir);
+                ino = 0;
             }
 
-            if (try_state)
+            if (nb == alloc)
             {
-                p (LVL_DEBUG, "TryExec: found & executable\n");
+                alloc += 64;
+                files = realloc (files, sizeof (*files) * (size_t) alloc);
+                inos = realloc (inos, sizeof (*inos) * (size_t) alloc);
             }
-            else
+            files[nb] = file;
+            inos[nb] = ino;
+            ++nb;
+
+            if (!dp)
             {
-                p (LVL_VERBOSE, "%s: unable to find executable TryExec (%s), "
-                        "no autostart\n",
-                        file, d.try_exec);
-                if (data != buf)
-                {
-                    free (data);
-                }
-                return;
+                break;
             }
         }
+        if (dp)
+        {
+            closedir (dp);
+        }
+    }
 
-        int    need_free;
-        char **argv     = NULL;
-        int    argc     = -1;
-        int    alloc    = 0;
-        pid_t  pid;
-
-        p (LVL_VERBOSE, "%s: triggering auto-start\n", file);
+    order_readahead (files, inos, nb);
+    for (i = 0; i < nb; ++i)
+    {
+        free ((void *) files[i]);
+    }
+    free (files);
+    free (inos);
+    for (i = 0; i < nb_bundled; ++i)
+    {
+        free (bundled[i]);
+    }
+    free (bundled);
+}
 
-        s = d.exec;
-        need_free = replace_fields (&s, d.icon, NULL, file);
+/* opens the system index, if it is current and for the system folders starting
+ * at dirs[first], setting nb to how many there are. Returns NULL if they're to
+ * be read instead */
+static sysindex_t *
+open_sysindex (const dirs_t *dirs, int first, int *nb)
+{
+    sysindex_t *idx;
+    int         i;
 
-        if (d.terminal)
+    if (!(idx = sysindex_open (system_index)))
+    {
+        return NULL;
+    }
+    *nb = sysindex_nb_dirs (idx);
+    for (i = 0; i < *nb; ++i)
+    {
+        if (first + i >= dirs->len || !dirs->dirs[first + i].system
+                || strcmp (dirs->dirs[first + i].dir, sysindex_dir (idx, i)) != 0)
         {
-            if (term_cmd)
-            {
-                split_exec (term_cmd, &argc, &argv, &alloc);
-            }
-            if (!argv)
-            {
-                p (LVL_ERROR, "%s: error with terminal command line: %s\n",
-                        file, term_cmd);
-                if (data != buf)
-                {
-                    free (data);
-                }
-                if (need_free)
-                {
-                    free (s);
-                }
-                return;
-            }
+            break;
         }
+    }
+    if (i < *nb || (first + *nb < dirs->len && dirs->dirs[first + *nb].system))
+    {
+        p (LVL_VERBOSE, "system index %s not for the same folders, ignoring\n",
+                system_index);
+        sysindex_close (idx);
+        return NULL;
+    }
+    if (!sysindex_is_current (idx))
+    {
+        p (LVL_VERBOSE, "system index %s is stale, ignoring\n", system_index);
+        sysindex_close (idx);
+        return NULL;
+    }
+    return idx;
+}
 
-        split_exec (s, &argc, &argv, &alloc);
-        if (!argv)
+/* processes the system folders from the system index, and closes it */
+static void
+scan_sysindex (pipeline_t *pl, sysindex_t *idx)
+{
+    const char *data;
+    size_t      len;
+    int         i;
+
+    p (LVL_VERBOSE, "using system index %s\n", system_index);
+    for (i = 0; i < sysindex_len (idx); ++i)
+    {
+        data = sysindex_data (idx, i, &len);
+        scan_file (pl, sysindex_file_dir (idx, i), sysindex_name (idx, i), data, len);
+    }
+    sysindex_close (idx);
+}
+
+static void *
+scan_dirs (void *arg)
+{
+    pipeline_t *pl = arg;
+    sysindex_t *idx = NULL;
+    char       *dir;
+    int         found = 0;
+    int         first = 0;      /* first system folder */
+    int         nb_indexed = 0; /* system folders processed from index */
+    int         i;
+
+    /* decided upfront, not to read ahead what comes from the index */
+    if (!pl->name && *system_index)
+    {
+        for ( ; first < pl->dirs->len && !pl->dirs->dirs[first].system; ++first)
+            ;
+        if (first < pl->dirs->len && !(idx = open_sysindex (pl->dirs, first, &nb_indexed)))
         {
-            p (LVL_ERROR, "%s: error processing command line\n", file);
-            if (data != buf)
-            {
-                free (data);
-            }
-            if (need_free)
-            {
-                free (s);
-            }
-            return;
+            nb_indexed = 0;
         }
+    }
+    if (physical_order && !pl->name)
+    {
+        read_ahead_dirs (pl->dirs, first, nb_indexed);
+    }
+
+    p (LVL_DEBUG, "processing folders\n");
+    for (i = 0; i < pl->dirs->len; ++i)
+    {
+        DIR           *dp;
+        struct dirent *dirent;
+        size_t         l;
 
-        /* expand ~ to $HOME */
-        if (home)
+        dir = pl->dirs->dirs[i].dir;
+        /* all system folders at once, from the index if possible */
+        if (idx && i == first)
         {
-            for (i = 0; i <= argc; ++i)
-            {
-                /* should we expand the ~ for $HOME */
-                if (argv[i][0] == '~')
-                {
-                    if (!ptr_to_free)
-                    {
-                        /* alloc ptr_to_free to contain enough if all argv left
-                         * will need expansion; +1 to be NULL-terminated */
-                        ptr_to_free = calloc ((size_t) (argc - i + 2),
-                                sizeof (*ptr_to_free));
-                        a = ptr_to_free;
-                    }
-                    *a = malloc (sizeof (**a) * (len_home + strlen (argv[i])));
-                    sprintf (*a, "%s%s", home, argv[i] + 1);
-                    /* replace pointer in argv */
-                    argv[i] = *a;
-                    ++a;
-                }
-            }
+            scan_sysindex (pl, idx);
+            idx = NULL;
         }
-
-        if (verbose >= LVL_DEBUG)
+        if (i >= first && i < first + nb_indexed)
         {
-            for (i = 0; i <= argc; ++i)
-            {
-                p (LVL_DEBUG, "argv[%d]=%s\n", i, argv[i]);
-            }
+            goto free_dir;
         }
-
-        if (dry_run)
+        TRACE (dir__open, dir);
+        /* one file only: first dir that has it wins, as per precedence */
+        if (pl->name)
         {
-            p (LVL_NORMAL, "auto-start: %s", argv[0]);
-            for (a = argv + 1; *a; ++a)
+            if (!found)
             {
-                p (LVL_NORMAL, " %s", *a);
+                found = scan_name (pl, dir);
             }
-            p (LVL_NORMAL, "\n");
+            goto next;
         }
-        else
+        p (LVL_VERBOSE, "open folder %s\n", dir);
+        if (!(dp = opendir (dir)))
         {
-            pid = fork ();
-            if (pid == 0)
+            if (errno == ENOENT)
+            {
+                p (LVL_VERBOSE, "skip: %s does not exists\n", dir);
+            }
+            else if (errno == ENOTDIR)
             {
-                /* child */
-                execvp (argv[0], argv);
-                exit (1);
+                scan_bundle (pl, dir);
             }
-            else if (pid == -1)
+            else
             {
-                p (LVL_ERROR, "%s: unable to fork\n", file);
+                p (LVL_ERROR, "failed to open %s\n", dir);
             }
+            goto next;
         }
 
-        /* free pointer(s) alloc-ed to expand ~ */
-        if (ptr_to_free)
+        while ((dirent = readdir (dp)))
         {
-            for (a = ptr_to_free; *a; ++a)
+            if (!(dirent->d_type & DT_REG))
+            {
+                /* ignore directory, etc -- symlinks to file are NOT ignored */
+                p (LVL_DEBUG, "\n%s: not a file, ignoring\n", dirent->d_name);
+                continue;
+            }
+
+            l = strlen (dirent->d_name);
+            /* 8 == strlen (".desktop") */
+            if (l < 8 || strcmp (".desktop", &dirent->d_name[l - 8]) != 0)
             {
-                free (*a);
+                /* ignore anything not .desktop */
+                p (LVL_DEBUG, "\n%s: not named *.desktop, ignoring\n", dirent->d_name);
+                continue;
             }
-            free (ptr_to_free);
+
+            scan_file (pl, dir, dirent->d_name, NULL, 0);
         }
-        free (argv);
-        if (need_free)
+        p (LVL_VERBOSE, "\nclosing folder\n");
+        closedir (dp);
+
+next:
+        TRACE (dir__close, dir);
+free_dir:
+        if (   pl->dirs->dirs[i].type == DIR_ADD_SUFFIX
+                || pl->dirs->dirs[i].type == DIR_NEEDS_FREE)
         {
-            free (s);
+            free ((void *) pl->dirs->dirs[i].dir);
         }
     }
-    else
+    free (pl->dirs->dirs);
+
+    queue_push (&pl->scanned, NULL);
+    return NULL;
+}
+
+static void *
+parse_files (void *arg)
+{
+    pipeline_t *pl = arg;
+    desktop_t  *d;
+    entry_t    *entry;
+    scanned_t  *item;
+
+    while ((item = queue_pop (&pl->scanned)))
     {
-        p (LVL_VERBOSE, "parsing failed (%d), no auto-start\n", state);
+        d = parse_desktop (strrchr (item->file, '/') + 1, item->file, item->data);
+        free (item->file);
+        free (item);
+
+        if (pl->last_desktop)
+        {
+            pl->last_desktop->next = d;
+        }
+        else
+        {
+            pl->desktops = d;
+        }
+        pl->last_desktop = d;
+
+        if (pl->profile && (entry = make_entry (d, pl->profile)))
+        {
+            queue_push (&pl->parsed, entry);
+        }
     }
 
-    if (data != buf)
+    if (pl->profile)
     {
-        free (data);
+        queue_push (&pl->parsed, NULL);
     }
+    return NULL;
 }
 
+/* sets entry's command line (after split_exec & ~ expansion) with its
+ * executable canonicalized, i.e. resolved in PATH & through symlinks, as a
+ * block of NUL-terminated strings */
 static void
-add_dir (dirs_t *dirs, char *dir, dir_type_t type)
+set_cmd_key (entry_t *entry)
 {
-    int     i;
-    size_t  l;
+    char    exe[PATH_MAX];
+    char   *path;
     char   *s;
+    size_t  len;
+    int     i;
 
-    l = strlen (dir);
-    if (type == DIR_ADD_SUFFIX)
+    path = (strchr (entry->argv[0], '/')) ? entry->argv[0]
+        : find_in_path (entry->argv[0]);
+    if (!path || !realpath (path, exe))
     {
-        /* 11 = strlen ("/autostart") + 1 for NULL */
-        s = malloc (sizeof (*s) * (l + 11));
-        sprintf (s, "%s%sautostart", dir, dir[l - 1] == '/' ? "" : "/");
-        if (dir[l - 1] != '/')
+        /* still catches the exact same command line */
+        snprintf (exe, sizeof (exe), "%s", entry->argv[0]);
+    }
+    if (path != entry->argv[0])
+    {
+        free (path);
+    }
+
+    len = strlen (exe) + 1;
+    for (i = 1; entry->argv[i]; ++i)
+    {
+        len += strlen (entry->argv[i]) + 1;
+    }
+    /* so "env VAR=val app" isn't the same as "app" */
+    for (i = 0; entry->env && entry->env[i]; ++i)
+    {
+        len += strlen (entry->env[i]) + 1;
+    }
+    entry->cmd_key = s = malloc (len);
+    entry->cmd_key_len = len;
+    for (i = 0; entry->env && entry->env[i]; ++i)
+    {
+        s = stpcpy (s, entry->env[i]) + 1;
+    }
+    s = stpcpy (s, exe) + 1;
+    for (i = 1; entry->argv[i]; ++i)
+    {
+        s = stpcpy (s, entry->argv[i]) + 1;
+    }
+}
+
+/* returns the entry already in entries with the same command line, if any;
+ * since entries come in order of precedence, it's the one to keep */
+static entry_t *
+find_duplicate (entry_t *entries, entry_t *entry)
+{
+    entry_t *e;
+
+    set_cmd_key (entry);
+    for (e = entries; e; e = e->next)
+    {
+        if (e->cmd_key_len == entry->cmd_key_len
+                && memcmp (e->cmd_key, entry->cmd_key, entry->cmd_key_len) == 0)
         {
-            ++l;
+            return e;
         }
-        l += 9; /* 9 = strlen ("autostart") */
-        dir = s;
     }
+    return NULL;
+}
 
-    if (l && dir[l - 1] == '/')
+static void
+add_entry (launch_t *launch, running_t *running, entry_t **entries,
+           entry_t **last, entry_t *entry)
+{
+    entry_t *dup;
+
+    if (run_lock && runlock_has (run_lock, entry->name))
     {
-        dir[l - 1] = '\0';
+        p (LVL_VERBOSE, "%s: started by another dapper, no auto-start\n", entry->name);
+        TRACE (filter, entry->name, "runlock", 0);
+        if (launch)
+        {
+            launch_skip (launch, entry->name, "merged");
+        }
+        free_entry (entry);
+        return;
     }
 
-    /* make sure this dir hasn't been processed already */
+    if ((dup = find_duplicate (*entries, entry)))
+    {
+        p ((dry_run) ? LVL_NORMAL : LVL_VERBOSE,
+                "%s: same command as %s, no auto-start\n", entry->name, dup->name);
+        TRACE (filter, entry->name, "duplicate", 0);
+        if (launch)
+        {
+            launch_skip (launch, entry->name, "duplicate");
+        }
+        free_entry (entry);
+        return;
+    }
+
+    if (running && running_has (running, entry->argv))
+    {
+        p (LVL_VERBOSE, "%s: already running, no auto-start\n", entry->name);
+        entry->running = 1;
+    }
+
+    /* first one through the terminal client: start the server beforehand */
+    if (entry->terminal)
+    {
+        entry_t *e;
+        entry_t *server;
+
+        for (e = *entries; e && strcmp (e->name, TERM_SERVER) != 0; e = e->next)
+            ;
+        if (!e && (server = make_term_server ()))
+        {
+            p (LVL_VERBOSE, "%s: starting terminal server\n", entry->name);
+            add_entry (launch, running, entries, last, server);
+        }
+    }
+
+    if (*last)
+    {
+        (*last)->next = entry;
+    }
+    else
+    {
+        *entries = entry;
+    }
+    *last = entry;
+    if (launch)
+    {
+        launch_add (launch, entry);
+    }
+}
+
+static void
+free_dirs (dirs_t *dirs)
+{
+    int i;
+
     for (i = 0; i < dirs->len; ++i)
     {
-        if (strcmp (dirs->dirs[i].dir, dir) == 0)
+        if (dirs->dirs[i].type == DIR_ADD_SUFFIX
+                || dirs->dirs[i].type == DIR_NEEDS_FREE)
         {
-            p (LVL_DEBUG, "%s: already listed, skipping\n", dir);
-            if (type == DIR_ADD_SUFFIX || type == DIR_NEEDS_FREE)
-            {
-                free ((char *) dir);
-            }
-            return;
+            free (dirs->dirs[i].dir);
         }
     }
-    if (dirs->len == dirs->alloc)
+    free (dirs->dirs);
+}
+
+static void
+free_profiles (profiles_t *profiles)
+{
+    int i;
+
+    for (i = 0; i < profiles->len; ++i)
     {
-        dirs->alloc += 10;
-        dirs->dirs = realloc (dirs->dirs, sizeof (*dirs->dirs) * (size_t) dirs->alloc);
+        free (profiles->profiles[i].name);
     }
-    p (LVL_DEBUG, "adding folder: %s\n", dir);
-    dirs->dirs[dirs->len].dir = (char *) dir;
-    dirs->dirs[dirs->len++].type = type;
+    free (profiles->profiles);
+}
+
+/* dapper --service: folders are scanned (and files parsed) once, and again on
+ * SIGHUP; each request then only goes through filtering & launching */
+typedef struct
+{
+    dirs_t     *dirs;       /* never scanned itself, see scan_all() */
+    profile_t  *profile;    /* default one */
+    desktop_t  *desktops;
+    files_t    *files;
+} service_t;
+
+/* scans & parses all files from a copy of dirs, since scan_dirs() frees them */
+static desktop_t *
+scan_all (const dirs_t *dirs, files_t **files)
+{
+    dirs_t     copy = { NULL, 0, 0 };
+    pipeline_t pl;
+    pthread_t  th_scan;
+    pthread_t  th_parse;
+    int        i;
+
+    for (i = 0; i < dirs->len; ++i)
+    {
+        add_dir (&copy, strdup (dirs->dirs[i].dir), DIR_NEEDS_FREE);
+        copy.dirs[copy.len - 1].system = dirs->dirs[i].system;
+    }
+    memset (&pl, 0, sizeof (pl));
+    pl.dirs = &copy;
+    queue_init (&pl.scanned, 64);
+    queue_init (&pl.parsed, 64);
+    if (start_thread (&th_scan, scan_dirs, &pl) != 0
+            || start_thread (&th_parse, parse_files, &pl) != 0)
+    {
+        p (LVL_ERROR, "unable to create thread\n");
+        exit (1);
+    }
+    pthread_join (th_scan, NULL);
+    pthread_join (th_parse, NULL);
+    queue_destroy (&pl.scanned);
+    queue_destroy (&pl.parsed);
+
+    *files = pl.files;
+    return pl.desktops;
+}
+
+static void
+free_scanned (desktop_t *desktops, files_t *files)
+{
+    desktop_t *d;
+    files_t   *f;
+
+    for ( ; desktops; desktops = d)
+    {
+        d = desktops->next;
+        free_desktop (desktops);
+    }
+    for ( ; files; files = f)
+    {
+        f = files->next;
+        free (files->name);
+        free (files);
+    }
+}
+
+static void
+reload_service (void *data)
+{
+    service_t *svc = data;
+
+    free_scanned (svc->desktops, svc->files);
+    svc->desktops = scan_all (svc->dirs, &svc->files);
 }
 
+/* processes a request from dapper --client, in a forked process */
 static int
-load_conf (char **data)
+serve_request (const service_req_t *req, void *data)
 {
-    int          ret = 0;
-    const char  *home = getenv ("HOME");
-    char        *file;
-    char         buf[2048];
-    size_t       len;
+    struct timespec ts_start;
+    service_t      *svc = data;
+    profile_t       profile = *svc->profile;
+    running_t      *running = NULL;
+    prefetch_t     *pf = NULL;
+    launch_t       *launch;
+    entry_t        *entries = NULL;
+    entry_t        *last_entry = NULL;
+    entry_t        *entry;
+    desktop_t      *d;
+    desktop_t      *found = NULL;
+    int             not_started;
+
+    /* delays are relative to the request */
+    clock_gettime (CLOCK_MONOTONIC, &ts_start);
+    verbose = req->verbose;
+    dry_run = req->dry_run;
+    /* worker threads weren't forked along, so check TryExec etc directly */
+    probe_init (0);
+    if (req->op == SERVICE_AUTOSTART && *req->name)
+    {
+        profile.desktop = (char *) req->name;
+    }
 
-    if (!home)
+    if (skip_running)
+    {
+        running = running_scan ();
+    }
+    if (prefetch)
+    {
+        pf = prefetch_start ();
+    }
+    launch = launch_new (pf, (dry_run) ? LAUNCH_DRY_RUN : 0, &ts_start, NULL);
+    if (gate_conf.cpu || gate_conf.io || gate_conf.memory || gate_conf.mem_available)
+    {
+        launch_set_gate (launch, &gate_conf);
+    }
+    if (wait_display)
     {
-        p (LVL_ERROR, "cannot load configuration: unable to get HOME path\n");
-        return ret;
+        launch_set_display (launch, display_timeout);
     }
 
-    len = (size_t) snprintf (buf, 2048, "%s/.config/dapper.conf", home);
-    if (len < 2048)
+    for (d = svc->desktops; d; d = d->next)
     {
-        file = buf;
+        if (req->op == SERVICE_LAUNCH && strcmp (d->name, req->name) != 0)
+        {
+            continue;
+        }
+        found = d;
+        if ((entry = make_entry (d, &profile)))
+        {
+            add_entry (launch, running, &entries, &last_entry, entry);
+        }
     }
-    else
+    launch_run (launch);
+    not_started = (found && launch_not_started (launch, found->name));
+    launch_free (launch);
+    if (pf)
     {
-        file = malloc (sizeof (*file) * (len + 1));
-        sprintf (file, "%s/.config/dapper.conf", home);
+        prefetch_finish (pf);
     }
-
-    p (LVL_VERBOSE, "loading config from %s\n", file);
-    ret = parse_file (0, file, data, 0, NULL);
-    ret = (ret == PARSE_OK || ret == PARSE_FILE_NOT_FOUND);
-    p (LVL_VERBOSE, "\n");
-
-    if (file != buf)
+    for ( ; entries; entries = entry)
     {
-        free (file);
+        entry = entries->next;
+        free_entry (entries);
+    }
+    if (running)
+    {
+        running_free (running);
     }
 
-    return ret;
-}
-
-static void
-show_help (void)
-{
-    fprintf (stdout, PACKAGE_NAME " - Desktop Applications Autostarter v" PACKAGE_VERSION "\n");
-    fprintf (stdout, "\n");
-    fprintf (stdout, " -h, --help               Show this help screen and exit\n");
-    fprintf (stdout, " -V, --version            Show version information and exit\n");
-    fprintf (stdout, " -s, --system-dirs        Process autostart from system folders\n");
-    fprintf (stdout, " -u, --user-dir           Process autostart from user folder\n");
-    fprintf (stdout, " -e, --extra-dir PATH     Process autostart from PATH\n");
-    fprintf (stdout, " -d, --desktop DESKTOP    Start applications for DESKTOP\n");
-    fprintf (stdout, " -t, --terminal CMDLINE   Use CMDLINE as prefix for terminal mode\n");
-    fprintf (stdout, " -v, --verbose            Verbose mode (twice for debug mode)\n");
-    fprintf (stdout, " -n, --dry-run            Do not actually start anything\n");
-    exit (0);
-}
-
-static void
-show_version (void)
-{
-    fprintf (stdout, PACKAGE_NAME " - Desktop Applications Autostarter v" PACKAGE_VERSION "\n");
-    fprintf (stdout, "Copyright (C) 2012-2013 Olivier Brunel\n");
-    fprintf (stdout, "License GPLv3+: GNU GPL version 3 or later <http://gnu.org/licenses/gpl.html>\n");
-    fprintf (stdout, "This is free software: you are free to change and redistribute it.\n");
-    fprintf (stdout, "There is NO WARRANTY, to the extent permitted by law.\n");
-    exit (0);
+    if (req->op == SERVICE_LAUNCH && !found)
+    {
+        p (LVL_ERROR, "%s: not found\n", req->name);
+        return 1;
+    }
+    else if (req->op == SERVICE_LAUNCH && found->skip)
+    {
+        p (LVL_ERROR, "%s: not started (%s)\n", req->name, found->skip);
+        return 1;
+    }
+    else if (req->op == SERVICE_LAUNCH && not_started)
+    {
+        p (LVL_ERROR, "%s: not started (dependencies)\n", req->name);
+        return 1;
+    }
+    return 0;
 }
 
 int
 main (int argc, char **argv)
 {
+    struct timespec ts_start;
     char    *data_conf  = NULL;
     dirs_t   dirs       = { NULL, 0, 0 };
     files_t *files      = NULL;
+    desktop_t *desktops = NULL;
+    desktop_t *d;
+    profiles_t profiles = { NULL, 0, 0 };
+    profile_t *profile;
+    entry_t *entry;
     char    *dir;
     char    *s          = NULL;
     char    *ss;
-
+    char    *pack_dir   = NULL;
+    char    *sim_file   = NULL;
+    sim_t   *sim        = NULL;
+    char    *launch_name = NULL;
+    int      service    = 0;
+    int      client     = 0;
+    int      stop       = 0;
+    int      check      = 0;
+    int      build_index = 0;
+    int      not_started = 0;
+    int      ret        = 0;
+    size_t   l;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts_start);
     if (load_conf (&data_conf) == 0)
     {
         free (data_conf);
@@ -1063,12 +2993,29 @@ main (int argc, char **argv)
         { "desktop",        required_argument,  0,  'd' },
         { "terminal",       required_argument,  0,  't' },
         { "verbose",        no_argument,        0,  'v' },
+        { "profile",        required_argument,  0,  'P' },
         { "dry-run",        no_argument,        0,  'n' },
+        { "prefetch",       no_argument,        0,  'p' },
+        { "skip-running",   no_argument,        0,  'R' },
+        { "track",          no_argument,        0,  'T' },
+        { "status-socket",  no_argument,        0,  'S' },
+        { "account",        required_argument,  0,  'A' },
+        { "wait-display",   no_argument,        0,  'W' },
+        { "stop",           no_argument,        0,  OPT_STOP },
+        { "pack",           required_argument,  0,  OPT_PACK },
+        { "check",          no_argument,        0,  'c' },
+        { "simulate",       required_argument,  0,  OPT_SIMULATE },
+        { "launch",         required_argument,  0,  OPT_LAUNCH },
+        { "service",        no_argument,        0,  OPT_SERVICE },
+        { "client",         no_argument,        0,  OPT_CLIENT },
+        { "run-lock",       required_argument,  0,  OPT_RUN_LOCK },
+        { "read-order",     required_argument,  0,  OPT_READ_ORDER },
+        { "build-system-index", no_argument,    0,  OPT_BUILD_INDEX },
         { 0,                0,                  0,    0 },
     };
     for (;;)
     {
-        o = getopt_long (argc, argv, "hVsue:d:t:vn", options, &index);
+        o = getopt_long (argc, argv, "hVsue:d:P:t:vnpRTSA:Wc", options, &index);
         if (o == -1)
         {
             break;
@@ -1111,37 +3058,43 @@ main (int argc, char **argv)
                 }
                 break;
             case 's':
-                p (LVL_DEBUG, "add system dirs\n");
-                if ((s = getenv ("XDG_CONFIG_DIRS")))
-                {
-                    p (LVL_VERBOSE, "XDG_CONFIG_DIRS set to %s\n", s);
-                    dir = s = strdup (s);
-                    while ((ss = strchr (dir, ':')))
-                    {
-                        *ss = '\0';
-                        add_dir (&dirs, dir, DIR_ADD_SUFFIX);
-                        dir = ss + 1;
-                    }
-                    add_dir (&dirs, dir, DIR_ADD_SUFFIX);
-                    free (s);
-                }
-                /* not defined, use default */
-                else
-                {
-                    p (LVL_VERBOSE, "XDG_CONFIG_DIRS not set, using default: /etc/xdg\n");
-                    add_dir (&dirs, (char *) "/etc/xdg/autostart", DIR_CONST);
-                }
+                add_system_dirs (&dirs);
                 break;
             case 'e':
                 p (LVL_DEBUG, "add extra dir: %s\n", optarg);
                 add_dir (&dirs, optarg, DIR_CONST);
                 break;
             case 'd':
-                desktop = optarg;
-                p (LVL_VERBOSE, "cmdline: set desktop to %s\n", desktop);
+                p (LVL_VERBOSE, "cmdline: add desktop %s\n", optarg);
+                profile = get_profile (&profiles, optarg, strlen (optarg), 1);
+                if (!profile->desktop)
+                {
+                    profile->desktop = optarg;
+                }
+                break;
+            case 'P':
+                if (!(profile = get_profile (&conf_profiles, optarg,
+                                strlen (optarg), 0)))
+                {
+                    p (LVL_ERROR, "unknown profile: %s\n", optarg);
+                    return 1;
+                }
+                if (!profile->desktop)
+                {
+                    p (LVL_ERROR, "profile %s: no desktop defined\n", optarg);
+                    return 1;
+                }
+                p (LVL_VERBOSE, "cmdline: add profile %s\n", optarg);
+                s = profile->desktop;
+                ss = profile->term_cmd;
+                profile = get_profile (&profiles, optarg, strlen (optarg), 1);
+                profile->desktop = s;
+                profile->term_cmd = ss;
                 break;
             case 't':
                 term_cmd = optarg;
+                /* the one prefix to use */
+                term_server = NULL;
                 p (LVL_VERBOSE, "cmdline: set terminal command line prefix to: %s\n",
                         term_cmd);
                 break;
@@ -1151,137 +3104,431 @@ main (int argc, char **argv)
             case 'n':
                 dry_run = 1;
                 break;
+            case 'p':
+                prefetch = 1;
+                break;
+            case 'R':
+                skip_running = 1;
+                break;
+            case 'T':
+                track = 1;
+                break;
+            case 'S':
+                status = 1;
+                break;
+            case 'A':
+                if (strcmp (optarg, "text") == 0)
+                {
+                    account = 1;
+                }
+                else if (strcmp (optarg, "json") == 0)
+                {
+                    account = 2;
+                }
+                else
+                {
+                    p (LVL_ERROR, "invalid report format: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'W':
+                wait_display = 1;
+                break;
+            case OPT_STOP:
+                stop = 1;
+                break;
+            case 'c':
+                check = 1;
+                break;
+            case OPT_PACK:
+                pack_dir = optarg;
+                break;
+            case OPT_SIMULATE:
+                sim_file = optarg;
+                break;
+            case OPT_SERVICE:
+                service = 1;
+                break;
+            case OPT_CLIENT:
+                client = 1;
+                break;
+            case OPT_RUN_LOCK:
+                if ((o = parse_run_lock (optarg)) < 0)
+                {
+                    p (LVL_ERROR, "invalid run lock policy: %s\n", optarg);
+                    return 1;
+                }
+                run_lock_policy = (runlock_policy_t) o;
+                break;
+            case OPT_BUILD_INDEX:
+                build_index = 1;
+                break;
+            case OPT_READ_ORDER:
+                if ((physical_order = parse_read_order (optarg)) < 0)
+                {
+                    p (LVL_ERROR, "invalid read order: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPT_LAUNCH:
+                if (!*optarg || strchr (optarg, '/'))
+                {
+                    p (LVL_ERROR, "invalid name: %s\n", optarg);
+                    return 1;
+                }
+                free (launch_name);
+                l = strlen (optarg);
+                /* 9 = strlen (".desktop") + 1 for NULL */
+                launch_name = malloc (sizeof (*launch_name) * (l + 9));
+                sprintf (launch_name, "%s%s", optarg,
+                        (l > 8 && strcmp (optarg + l - 8, ".desktop") == 0)
+                        ? "" : ".desktop");
+                break;
             case '?': /* unknown option */
             default:
                 return 1;
         }
     }
+    if (stop)
+    {
+        free (dirs.dirs);
+        free (data_conf);
+        return launch_stop_tracked ();
+    }
+    if (pack_dir)
+    {
+        if (optind + 1 != argc)
+        {
+            p (LVL_ERROR, "--pack requires a folder and an output file\n");
+            return 1;
+        }
+        o = bundle_pack (pack_dir, argv[optind]);
+        free (dirs.dirs);
+        free (data_conf);
+        return o;
+    }
     if (optind < argc)
     {
         p (LVL_ERROR, "unknown argument: %s\n", argv[optind]);
         return 1;
     }
+    if (build_index)
+    {
+        dirs_t       sys = { NULL, 0, 0 };
+        const char **paths;
+        int          i;
+
+        if (!*system_index)
+        {
+            p (LVL_ERROR, "no system index set\n");
+            return 1;
+        }
+        add_system_dirs (&sys);
+        paths = malloc (sizeof (*paths) * (size_t) sys.len);
+        for (i = 0; i < sys.len; ++i)
+        {
+            paths[i] = sys.dirs[i].dir;
+        }
+        o = sysindex_build (paths, sys.len, system_index);
+        free (paths);
+        free_dirs (&sys);
+        free_dirs (&dirs);
+        free (data_conf);
+        return o;
+    }
 
-    if (dirs.len == 0)
+    /* the service has its own folders */
+    if (dirs.len == 0 && !client)
     {
         show_help ();
         /* not reached */
         return 1;
     }
 
-    int i;
-    p (LVL_DEBUG, "processing folders\n");
-    for (i = 0; i < dirs.len; ++i)
+    if (check)
     {
-        DIR           *dp;
-        struct dirent *dirent;
-        size_t         l;
+        char **paths;
+        int    i;
 
-        dir = dirs.dirs[i].dir;
-        p (LVL_VERBOSE, "open folder %s\n", dir);
-        if (!(dp = opendir (dir)))
+        /* errors are reported as diagnostics instead */
+        if (verbose == 0)
         {
-            if (errno == ENOENT)
-            {
-                p (LVL_VERBOSE, "skip: %s does not exists\n", dir);
-            }
-            else
+            verbose = LVL_QUIET;
+        }
+        paths = malloc (sizeof (*paths) * (size_t) dirs.len);
+        for (i = 0; i < dirs.len; ++i)
+        {
+            paths[i] = dirs.dirs[i].dir;
+        }
+        o = check_dirs (paths, dirs.len, check_file);
+        for (i = 0; i < dirs.len; ++i)
+        {
+            if (dirs.dirs[i].type == DIR_ADD_SUFFIX
+                    || dirs.dirs[i].type == DIR_NEEDS_FREE)
             {
-                p (LVL_ERROR, "failed to open %s\n", dir);
+                free (dirs.dirs[i].dir);
             }
-            continue;
         }
+        free (paths);
+        free (dirs.dirs);
+        free (data_conf);
+        return o;
+    }
 
-        while ((dirent = readdir (dp)))
+    if (profiles.len == 0)
+    {
+        /* use desktop from config */
+        profile = get_profile (&profiles, "", 0, 1);
+        profile->desktop = desktop;
+    }
+    else if (profiles.len > 1 && !dry_run && !sim_file)
+    {
+        p (LVL_ERROR, "multiple desktops/profiles can only be used with --dry-run\n");
+        return 1;
+    }
+
+    if ((service || client) && profiles.len > 1)
+    {
+        p (LVL_ERROR, "multiple desktops/profiles cannot be used with --service or --client\n");
+        return 1;
+    }
+    else if (client)
+    {
+        /* everything else is up to the service */
+        o = service_request ((launch_name) ? SERVICE_LAUNCH : SERVICE_AUTOSTART,
+                (launch_name) ? launch_name
+                : (profiles.profiles[0].desktop) ? profiles.profiles[0].desktop : "",
+                dry_run);
+        free_dirs (&dirs);
+        free_profiles (&profiles);
+        free_profiles (&conf_profiles);
+        free (launch_name);
+        free (data_conf);
+        return o;
+    }
+    else if (service)
+    {
+        service_t svc;
+
+        probe_init (probe_timeout);
+        svc.dirs = &dirs;
+        svc.profile = &profiles.profiles[0];
+        svc.desktops = scan_all (&dirs, &svc.files);
+        o = service_run (serve_request, reload_service, &svc);
+        free_scanned (svc.desktops, svc.files);
+        free_dirs (&dirs);
+        free_profiles (&profiles);
+        free_profiles (&conf_profiles);
+        free (launch_name);
+        free (data_conf);
+        return o;
+    }
+
+    if (sim_file && !(sim = sim_load (sim_file)))
+    {
+        return 1;
+    }
+
+    /* before anything, so a concurrent dapper can wait for our launch set */
+    if (run_lock_policy != RUNLOCK_NONE && !dry_run && !sim_file)
+    {
+        run_lock = runlock_acquire (run_lock_policy, &o);
+        if (o)
         {
-            if (!(dirent->d_type & DT_REG))
+            free_dirs (&dirs);
+            free_profiles (&profiles);
+            free_profiles (&conf_profiles);
+            free (launch_name);
+            free (data_conf);
+            return 0;
+        }
+    }
+
+    pipeline_t pl;
+    pthread_t  th_scan;
+    pthread_t  th_parse;
+
+    /* TryExec & PATH lookups are done off a worker pool, so a hung mount
+     * can't block us */
+    probe_init (probe_timeout);
+
+    memset (&pl, 0, sizeof (pl));
+    pl.dirs = &dirs;
+    pl.name = launch_name;
+    /* with multiple profiles, everything must be parsed first */
+    pl.profile = (profiles.len == 1) ? &profiles.profiles[0] : NULL;
+    queue_init (&pl.scanned, 64);
+    queue_init (&pl.parsed, 64);
+    if (start_thread (&th_scan, scan_dirs, &pl) != 0
+            || start_thread (&th_parse, parse_files, &pl) != 0)
+    {
+        p (LVL_ERROR, "unable to create thread\n");
+        /* not return, as th_scan might be running, using pl */
+        exit (1);
+    }
+    /* while files are being scanned & parsed */
+    running_t *running = NULL;
+    if (skip_running)
+    {
+        running = running_scan ();
+    }
+
+    if (!pl.profile)
+    {
+        pthread_join (th_scan, NULL);
+        pthread_join (th_parse, NULL);
+    }
+
+    /* parsing is done once, and then each profile gets its launch set */
+    int j;
+    for (j = 0; j < profiles.len; ++j)
+    {
+        entry_t    *entries    = NULL;
+        entry_t    *last_entry = NULL;
+        prefetch_t *pf         = NULL;
+        launch_t   *launch;
+
+        profile = &profiles.profiles[j];
+        if (profiles.len > 1)
+        {
+            p (LVL_NORMAL, "%sprofile %s (desktop %s):\n",
+                    (j > 0) ? "\n" : "", profile->name, profile->desktop);
+        }
+
+        /* with a simulation, entries are only collected here */
+        launch = NULL;
+        if (!sim)
+        {
+            if (prefetch)
             {
-                /* ignore directory, etc -- symlinks to file are NOT ignored */
-                p (LVL_DEBUG, "\n%s: not a file, ignoring\n", dirent->d_name);
-                continue;
+                p (LVL_VERBOSE, "\nprefetching executables & libraries\n");
+                pf = prefetch_start ();
             }
-
-            l = strlen (dirent->d_name);
-            /* 8 == strlen (".desktop") */
-            if (l < 8 || strcmp (".desktop", &dirent->d_name[l - 8]) != 0)
+            launch = launch_new (pf, (dry_run ? LAUNCH_DRY_RUN : 0)
+                    | (track ? LAUNCH_TRACK : 0) | (status ? LAUNCH_STATUS : 0),
+                    &ts_start, NULL);
+            if (gate_conf.cpu || gate_conf.io || gate_conf.memory
+                    || gate_conf.mem_available)
             {
-                /* ignore anything not .desktop */
-                p (LVL_DEBUG, "\n%s: not named *.desktop, ignoring\n", dirent->d_name);
-                continue;
+                launch_set_gate (launch, &gate_conf);
             }
-
-            files_t  *f;
-            files_t  *last = NULL;
-            files_t  *file;
-            int       process;
-
-            /* make sure we don't already have this item (from a previous dir) */
-            process = 1;
-            for (f = files; f; f = f->next)
+            if (account)
             {
-                last = f;
-                if (strcmp (dirent->d_name, f->name) == 0)
-                {
-                    process = 0;
-                    p (LVL_VERBOSE, "\n%s: name already processed, ignoring\n",
-                            dirent->d_name);
-                    break;
-                }
+                launch_set_account (launch, account_window, account == 2);
             }
-
-            if (process)
+            if (wait_display)
             {
-                p (LVL_VERBOSE, "\n%s: processing\n", dirent->d_name);
-
-                file = malloc (sizeof (*file));
-                file->name = strdup (dirent->d_name);
-                file->next = NULL;
-
-                char  buf[4096];
-                l = (size_t) snprintf (buf, 4096, "%s/%s", dir, dirent->d_name);
-                if (l < 4096)
-                {
-                    s = buf;
-                }
-                else
-                {
-                    s = malloc (sizeof (*s) * (l + 1));
-                    snprintf (s, l, "%s/%s", dir, dirent->d_name);
-                }
-
-                process_file (s);
+                launch_set_display (launch, display_timeout);
+            }
+        }
 
-                if (s != buf)
+        /* entries without dependencies are started as they come */
+        if (pl.profile)
+        {
+            while ((entry = queue_pop (&pl.parsed)))
+            {
+                add_entry (launch, running, &entries, &last_entry, entry);
+            }
+            pthread_join (th_scan, NULL);
+            pthread_join (th_parse, NULL);
+        }
+        else
+        {
+            for (d = pl.desktops; d; d = d->next)
+            {
+                if ((entry = make_entry (d, profile)))
                 {
-                    free (s);
+                    add_entry (launch, running, &entries, &last_entry, entry);
                 }
+            }
+        }
 
-                /* if we have a list, update the next pointer of the last item (l),
-                 * else this becomes the first item of the list */
-                if (files && last)
-                {
-                    last->next = file;
-                }
-                else
+        if (sim)
+        {
+            sim_run (sim, entries);
+        }
+        else
+        {
+            for (d = pl.desktops; d; d = d->next)
+            {
+                if (d->skip)
                 {
-                    files = file;
+                    launch_skip (launch, d->name, d->skip);
                 }
             }
+            /* the launch set is known, for any dapper waiting on us */
+            if (run_lock)
+            {
+                runlock_publish (run_lock, entries);
+            }
+            /* now that we know everything that is to be started, start the rest */
+            launch_run (launch);
+            if (launch_name && launch_not_started (launch, launch_name))
+            {
+                not_started = 1;
+            }
+            launch_free (launch);
+        }
+        if (pf)
+        {
+            prefetch_finish (pf);
         }
-        p (LVL_VERBOSE, "\nclosing folder\n");
-        closedir (dp);
 
-        if (   dirs.dirs[i].type == DIR_ADD_SUFFIX
-                || dirs.dirs[i].type == DIR_NEEDS_FREE)
+        entry_t *e, *ee;
+        for (e = entries; e; e = ee)
         {
-            free ((void *) dirs.dirs[i].dir);
+            ee = e->next;
+            free_entry (e);
         }
     }
-    free (dirs.dirs);
+    queue_destroy (&pl.scanned);
+    queue_destroy (&pl.parsed);
+    if (sim)
+    {
+        sim_free (sim);
+    }
+    if (running)
+    {
+        running_free (running);
+    }
+    if (run_lock)
+    {
+        runlock_free (run_lock);
+    }
+    files = pl.files;
+    desktops = pl.desktops;
+
+    /* so whoever asked to launch it knows it wasn't */
+    if (launch_name && !desktops)
+    {
+        p (LVL_ERROR, "%s: not found\n", launch_name);
+        ret = 1;
+    }
+    else if (launch_name && desktops->skip)
+    {
+        p (LVL_ERROR, "%s: not started (%s)\n", launch_name, desktops->skip);
+        ret = 1;
+    }
+    else if (not_started)
+    {
+        p (LVL_ERROR, "%s: not started (dependencies)\n", launch_name);
+        ret = 1;
+    }
+    free (launch_name);
 
     /* memory cleaning */
     p (LVL_DEBUG, "memory cleaning\n");
 
+    desktop_t *dd;
+    for (d = desktops; d; d = dd)
+    {
+        dd = d->next;
+        free_desktop (d);
+    }
+
+    free_profiles (&profiles);
+    free_profiles (&conf_profiles);
+
     files_t *f, *ff;
     for (f = files; f; f = ff)
     {
@@ -1292,6 +3539,6 @@ main (int argc, char **argv)
 
     free (data_conf);
 
-    return 0;
+    return ret;
 }
 
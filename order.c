@@ -0,0 +1,169 @@
+/**
+ * dapper - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * order.c
+ * Copyright (C) 2012-2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of dapper.
+ *
+ * dapper is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * dapper is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * dapper. If not, see http://www.gnu.org/licenses/
+ */
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+
+#include "config.h"
+#include "dapper.h"
+#include "order.h"
+
+#ifdef HAVE_LINUX_FIEMAP_H
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#endif
+
+/* where a file is on disk, as far as we can tell */
+typedef struct
+{
+    const char *file;
+    dev_t       dev;
+    ino_t       ino;
+    uint64_t    physical;       /* of its first extent; 0 if unknown */
+    off_t       size;
+} location_t;
+
+static int
+cmp_ino (const void *p1, const void *p2)
+{
+    const location_t *l1 = p1;
+    const location_t *l2 = p2;
+
+    return (l1->ino > l2->ino) - (l1->ino < l2->ino);
+}
+
+/* by device, then physical offset; files without one (e.g. data inlined in
+ * the inode, or no FIEMAP support) come first, in inode order */
+static int
+cmp_physical (const void *p1, const void *p2)
+{
+    const location_t *l1 = p1;
+    const location_t *l2 = p2;
+
+    if (l1->dev != l2->dev)
+    {
+        return (l1->dev > l2->dev) - (l1->dev < l2->dev);
+    }
+    if (l1->physical != l2->physical)
+    {
+        return (l1->physical > l2->physical) - (l1->physical < l2->physical);
+    }
+    return cmp_ino (p1, p2);
+}
+
+/* returns the physical offset of the first extent of fd, or 0 */
+static uint64_t
+get_physical (int fd)
+{
+#if defined (HAVE_LINUX_FIEMAP_H) && defined (FS_IOC_FIEMAP)
+    union
+    {
+        struct fiemap fm;
+        char          buf[sizeof (struct fiemap) + sizeof (struct fiemap_extent)];
+    } u;
+
+    memset (&u, 0, sizeof (u));
+    u.fm.fm_length = FIEMAP_MAX_OFFSET;
+    u.fm.fm_extent_count = 1;
+    if (ioctl (fd, FS_IOC_FIEMAP, &u.fm) == 0 && u.fm.fm_mapped_extents > 0
+            && !(u.fm.fm_extents[0].fe_flags
+                & (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DATA_INLINE)))
+    {
+        return u.fm.fm_extents[0].fe_physical;
+    }
+#else
+    (void) fd;
+#endif
+    return 0;
+}
+
+/* reads ahead all files, in the order they are on disk, so that on rotating
+ * disks parsing them doesn't cost a seek each. inos (from readdir) are used to
+ * first get to the inodes themselves in order */
+void
+order_readahead (const char **files, const ino_t *inos, int nb)
+{
+    location_t  *locs;
+    struct stat  statbuf;
+    int          nb_physical = 0;
+    int          fd;
+    int          i;
+
+    locs = calloc ((size_t) nb, sizeof (*locs));
+    for (i = 0; i < nb; ++i)
+    {
+        locs[i].file = files[i];
+        locs[i].ino = inos[i];
+    }
+    qsort (locs, (size_t) nb, sizeof (*locs), cmp_ino);
+
+    for (i = 0; i < nb; ++i)
+    {
+        if ((fd = open (locs[i].file, O_RDONLY | O_CLOEXEC)) < 0)
+        {
+            continue;
+        }
+        if (fstat (fd, &statbuf) == 0)
+        {
+            locs[i].dev = statbuf.st_dev;
+            locs[i].ino = statbuf.st_ino;
+            locs[i].size = statbuf.st_size;
+            if ((locs[i].physical = get_physical (fd)) > 0)
+            {
+                ++nb_physical;
+            }
+        }
+        close (fd);
+    }
+    qsort (locs, (size_t) nb, sizeof (*locs), cmp_physical);
+
+    for (i = 0; i < nb; ++i)
+    {
+        if (locs[i].size <= 0
+                || (fd = open (locs[i].file, O_RDONLY | O_CLOEXEC)) < 0)
+        {
+            continue;
+        }
+        p (LVL_DEBUG, "readahead %s at %llu\n", locs[i].file,
+                (unsigned long long) locs[i].physical);
+#ifdef HAVE_READAHEAD
+        if (readahead (fd, 0, (size_t) locs[i].size) < 0)
+#endif
+        {
+#ifdef HAVE_POSIX_FADVISE
+            posix_fadvise (fd, 0, locs[i].size, POSIX_FADV_WILLNEED);
+#endif
+        }
+        close (fd);
+    }
+    p (LVL_VERBOSE, "read ahead %d files in disk order (%d with known location)\n",
+            nb, nb_physical);
+    free (locs);
+}
@@ -0,0 +1,938 @@
+/**
+ * dapper - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * prefetch.c
+ * Copyright (C) 2012-2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of dapper.
+ *
+ * dapper is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * dapper is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * dapper. If not, see http://www.gnu.org/licenses/
+ */
+
+/* for readahead */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <glob.h>
+#include <elf.h>
+
+#include "config.h"
+#include "dapper.h"
+#include "prefetch.h"
+
+/* searched last by the dynamic loader, after what's in ld.so.conf */
+#define DEFAULT_LIB_DIRS        "/lib64:/usr/lib64:/lib:/usr/lib"
+#define LD_SO_CONF              "/etc/ld.so.conf"
+/* how deep we follow libraries (of libraries (of libraries...)) */
+#define MAX_DEPTH               32
+/* max length of a shebang line we'll look at */
+#define MAX_SHEBANG             256
+/* how long a launch waits, at most, for its entry to be prefetched (in ms) */
+#define MAX_WAIT                100
+
+/* state of an entry */
+#define PF_QUEUED               0
+#define PF_BUSY                 1
+#define PF_DONE                 2
+
+typedef struct
+{
+    dev_t dev;
+    ino_t ino;
+} file_id_t;
+
+struct _prefetch_t
+{
+    pthread_t        thread;
+    pthread_mutex_t  mutex;
+    pthread_cond_t   cond;
+    /* under mutex */
+    entry_t        **entries;
+    char            *states;        /* PF_* of each entry */
+    int              entries_alloc;
+    int              entries_len;
+    int              ended;         /* no more entries will be added */
+    int              next;          /* first one that might still be queued */
+    int              urgent;        /* one to do next (being waited on), or -1 */
+    /* hash set of files already prefetched */
+    file_id_t       *seen;
+    size_t           seen_alloc;    /* always a power of 2 */
+    size_t           seen_len;
+    /* dirs from ld.so.conf + defaults */
+    char           **lib_dirs;
+    int              lib_dirs_alloc;
+    int              lib_dirs_len;
+    /* stats */
+    unsigned int     nb_files;
+    unsigned long    nb_bytes;
+    struct timespec  ts_start;
+};
+
+typedef struct
+{
+    const char  *interp;
+    const char  *rpath;
+    const char  *runpath;
+    const char **needed;
+    int          nb_needed;
+} elf_deps_t;
+
+typedef struct
+{
+    uint32_t type;
+    uint64_t offset;
+    uint64_t vaddr;
+    uint64_t filesz;
+} phdr_t;
+
+static int prefetch_file (prefetch_t *pf, const char *file,
+        unsigned char class, uint16_t machine, int depth);
+
+static size_t
+hash_id (dev_t dev, ino_t ino)
+{
+    return (size_t) ((uint64_t) ino * 2654435761u) ^ (size_t) dev;
+}
+
+/* returns 1 if the file was added, 0 if it was already in the set */
+static int
+mark_seen (prefetch_t *pf, dev_t dev, ino_t ino)
+{
+    size_t i;
+
+    if (pf->seen_len * 2 >= pf->seen_alloc)
+    {
+        file_id_t *old       = pf->seen;
+        size_t     old_alloc = pf->seen_alloc;
+
+        pf->seen_alloc = (old_alloc) ? old_alloc * 2 : 64;
+        pf->seen = calloc (pf->seen_alloc, sizeof (*pf->seen));
+        for (i = 0; i < old_alloc; ++i)
+        {
+            size_t h;
+
+            if (old[i].ino == 0)
+            {
+                continue;
+            }
+            h = hash_id (old[i].dev, old[i].ino) & (pf->seen_alloc - 1);
+            while (pf->seen[h].ino != 0)
+            {
+                h = (h + 1) & (pf->seen_alloc - 1);
+            }
+            pf->seen[h] = old[i];
+        }
+        free (old);
+    }
+
+    /* inode 0 isn't valid, so it marks empty slots */
+    i = hash_id (dev, ino) & (pf->seen_alloc - 1);
+    while (pf->seen[i].ino != 0)
+    {
+        if (pf->seen[i].ino == ino && pf->seen[i].dev == dev)
+        {
+            return 0;
+        }
+        i = (i + 1) & (pf->seen_alloc - 1);
+    }
+    pf->seen[i].dev = dev;
+    pf->seen[i].ino = ino;
+    ++pf->seen_len;
+    return 1;
+}
+
+static void
+add_lib_dir (prefetch_t *pf, const char *dir)
+{
+    int i;
+
+    for (i = 0; i < pf->lib_dirs_len; ++i)
+    {
+        if (strcmp (pf->lib_dirs[i], dir) == 0)
+        {
+            return;
+        }
+    }
+    if (pf->lib_dirs_len == pf->lib_dirs_alloc)
+    {
+        pf->lib_dirs_alloc += 10;
+        pf->lib_dirs = realloc (pf->lib_dirs,
+                sizeof (*pf->lib_dirs) * (size_t) pf->lib_dirs_alloc);
+    }
+    p (LVL_DEBUG, "prefetch: library folder %s\n", dir);
+    pf->lib_dirs[pf->lib_dirs_len++] = strdup (dir);
+}
+
+static void
+load_ld_so_conf (prefetch_t *pf, const char *file, int depth)
+{
+    FILE *fp;
+    char  line[1024];
+    char *s;
+    char *dir;
+    char *saveptr;
+
+    if (depth > 8 || !(fp = fopen (file, "r")))
+    {
+        return;
+    }
+
+    while (fgets (line, sizeof (line), fp))
+    {
+        if ((s = strchr (line, '#')))
+        {
+            *s = '\0';
+        }
+        for (s = line; isspace (*s); ++s)
+            ;
+
+        if (strncmp (s, "include", 7) == 0 && isspace (s[7]))
+        {
+            glob_t g;
+            char   buf[1024];
+            size_t i;
+
+            for (s += 8; isspace (*s); ++s)
+                ;
+            dir = strtok_r (s, " \t\n", &saveptr);
+            if (!dir)
+            {
+                continue;
+            }
+            /* relative patterns are relative to /etc */
+            if (*dir != '/')
+            {
+                snprintf (buf, sizeof (buf), "/etc/%s", dir);
+                dir = buf;
+            }
+            if (glob (dir, 0, NULL, &g) == 0)
+            {
+                for (i = 0; i < g.gl_pathc; ++i)
+                {
+                    load_ld_so_conf (pf, g.gl_pathv[i], depth + 1);
+                }
+                globfree (&g);
+            }
+            continue;
+        }
+
+        for (dir = strtok_r (s, " \t\n:,", &saveptr);
+                dir;
+                dir = strtok_r (NULL, " \t\n:,", &saveptr))
+        {
+            add_lib_dir (pf, dir);
+        }
+    }
+    fclose (fp);
+}
+
+static void
+load_lib_dirs (prefetch_t *pf)
+{
+    char  buf[] = DEFAULT_LIB_DIRS;
+    char *dir;
+    char *saveptr;
+
+    load_ld_so_conf (pf, LD_SO_CONF, 0);
+    for (dir = strtok_r (buf, ":", &saveptr);
+            dir;
+            dir = strtok_r (NULL, ":", &saveptr))
+    {
+        add_lib_dir (pf, dir);
+    }
+}
+
+/* check file is an ELF of the native endianness, and get its class/machine */
+static int
+read_elf_id (int fd, unsigned char *class, uint16_t *machine)
+{
+    const uint16_t one = 1;
+    unsigned char  hdr[sizeof (Elf64_Ehdr)];
+    unsigned char  data;
+
+    if (pread (fd, hdr, sizeof (hdr), 0) < (ssize_t) sizeof (Elf32_Ehdr))
+    {
+        return 0;
+    }
+    data = (*(const unsigned char *) &one) ? ELFDATA2LSB : ELFDATA2MSB;
+    if (memcmp (hdr, ELFMAG, SELFMAG) != 0 || hdr[EI_DATA] != data
+            || (hdr[EI_CLASS] != ELFCLASS32 && hdr[EI_CLASS] != ELFCLASS64))
+    {
+        return 0;
+    }
+    *class = hdr[EI_CLASS];
+    /* e_machine is at the same offset for both classes */
+    memcpy (machine, hdr + offsetof (Elf64_Ehdr, e_machine), sizeof (*machine));
+    return 1;
+}
+
+/* returns the NUL-terminated string at offset, or NULL if out of bounds */
+static const char *
+elf_str (const unsigned char *map, size_t size, uint64_t offset)
+{
+    if (offset >= size || !memchr (map + offset, '\0', size - offset))
+    {
+        return NULL;
+    }
+    return (const char *) map + offset;
+}
+
+static int
+elf_get_deps (const unsigned char *map, size_t size, unsigned char class,
+        elf_deps_t *deps)
+{
+    phdr_t   *phdrs;
+    uint64_t  phoff;
+    uint16_t  phentsize;
+    uint16_t  phnum;
+    uint64_t  dyn_off   = 0;
+    uint64_t  dyn_size  = 0;
+    uint64_t  strtab    = 0;
+    uint64_t  strtab_off;
+    uint64_t  rpath     = (uint64_t) -1;
+    uint64_t  runpath   = (uint64_t) -1;
+    uint64_t *needed    = NULL;
+    int       nb_needed = 0;
+    int       has_strtab = 0;
+    uint64_t  off;
+    int       i;
+
+    memset (deps, 0, sizeof (*deps));
+    if (size < ((class == ELFCLASS64) ? sizeof (Elf64_Ehdr) : sizeof (Elf32_Ehdr)))
+    {
+        return 0;
+    }
+
+    if (class == ELFCLASS64)
+    {
+        Elf64_Ehdr eh;
+
+        memcpy (&eh, map, sizeof (eh));
+        phoff = eh.e_phoff;
+        phentsize = eh.e_phentsize;
+        phnum = eh.e_phnum;
+        if (phentsize < sizeof (Elf64_Phdr))
+        {
+            return 0;
+        }
+    }
+    else
+    {
+        Elf32_Ehdr eh;
+
+        memcpy (&eh, map, sizeof (eh));
+        phoff = eh.e_phoff;
+        phentsize = eh.e_phentsize;
+        phnum = eh.e_phnum;
+        if (phentsize < sizeof (Elf32_Phdr))
+        {
+            return 0;
+        }
+    }
+    if (phnum == 0 || phoff >= size
+            || (uint64_t) phnum * phentsize > size - phoff)
+    {
+        return 0;
+    }
+
+    phdrs = malloc (sizeof (*phdrs) * phnum);
+    for (i = 0; i < phnum; ++i)
+    {
+        off = phoff + (uint64_t) i * phentsize;
+        if (class == ELFCLASS64)
+        {
+            Elf64_Phdr ph;
+
+            memcpy (&ph, map + off, sizeof (ph));
+            phdrs[i].type   = ph.p_type;
+            phdrs[i].offset = ph.p_offset;
+            phdrs[i].vaddr  = ph.p_vaddr;
+            phdrs[i].filesz = ph.p_filesz;
+        }
+        else
+        {
+            Elf32_Phdr ph;
+
+            memcpy (&ph, map + off, sizeof (ph));
+            phdrs[i].type   = ph.p_type;
+            phdrs[i].offset = ph.p_offset;
+            phdrs[i].vaddr  = ph.p_vaddr;
+            phdrs[i].filesz = ph.p_filesz;
+        }
+
+        if (phdrs[i].type == PT_INTERP)
+        {
+            deps->interp = elf_str (map, size, phdrs[i].offset);
+        }
+        else if (phdrs[i].type == PT_DYNAMIC)
+        {
+            dyn_off = phdrs[i].offset;
+            dyn_size = phdrs[i].filesz;
+        }
+    }
+
+    if (dyn_size == 0 || dyn_off >= size || dyn_size > size - dyn_off)
+    {
+        free (phdrs);
+        return 1;
+    }
+
+    for (off = dyn_off; off < dyn_off + dyn_size; )
+    {
+        int64_t  tag;
+        uint64_t val;
+
+        if (class == ELFCLASS64)
+        {
+            Elf64_Dyn dyn;
+
+            if (dyn_off + dyn_size - off < sizeof (dyn))
+            {
+                break;
+            }
+            memcpy (&dyn, map + off, sizeof (dyn));
+            tag = dyn.d_tag;
+            val = dyn.d_un.d_val;
+            off += sizeof (dyn);
+        }
+        else
+        {
+            Elf32_Dyn dyn;
+
+            if (dyn_off + dyn_size - off < sizeof (dyn))
+            {
+                break;
+            }
+            memcpy (&dyn, map + off, sizeof (dyn));
+            tag = dyn.d_tag;
+            val = dyn.d_un.d_val;
+            off += sizeof (dyn);
+        }
+
+        if (tag == DT_NULL)
+        {
+            break;
+        }
+        else if (tag == DT_STRTAB)
+        {
+            strtab = val;
+            has_strtab = 1;
+        }
+        else if (tag == DT_RPATH)
+        {
+            rpath = val;
+        }
+        else if (tag == DT_RUNPATH)
+        {
+            runpath = val;
+        }
+        else if (tag == DT_NEEDED)
+        {
+            needed = realloc (needed, sizeof (*needed) * (size_t) (nb_needed + 1));
+            needed[nb_needed++] = val;
+        }
+    }
+
+    /* DT_STRTAB is an address, which we need to turn into a file offset */
+    strtab_off = (uint64_t) -1;
+    if (has_strtab)
+    {
+        for (i = 0; i < phnum; ++i)
+        {
+            if (phdrs[i].type == PT_LOAD && phdrs[i].vaddr <= strtab
+                    && strtab < phdrs[i].vaddr + phdrs[i].filesz)
+            {
+                strtab_off = strtab - phdrs[i].vaddr + phdrs[i].offset;
+                break;
+            }
+        }
+    }
+    free (phdrs);
+
+    if (strtab_off != (uint64_t) -1)
+    {
+        if (rpath != (uint64_t) -1)
+        {
+            deps->rpath = elf_str (map, size, strtab_off + rpath);
+        }
+        if (runpath != (uint64_t) -1)
+        {
+            deps->runpath = elf_str (map, size, strtab_off + runpath);
+        }
+        if (nb_needed > 0)
+        {
+            deps->needed = malloc (sizeof (*deps->needed) * (size_t) nb_needed);
+            for (i = 0; i < nb_needed; ++i)
+            {
+                const char *s = elf_str (map, size, strtab_off + needed[i]);
+                if (s)
+                {
+                    deps->needed[deps->nb_needed++] = s;
+                }
+            }
+        }
+    }
+    free (needed);
+
+    return 1;
+}
+
+/* try lib in each folder of the ':'-separated list dirs, with $ORIGIN
+ * expanded to origin */
+static int
+search_dirs (prefetch_t    *pf,
+             const char    *dirs,
+             const char    *origin,
+             const char    *lib,
+             unsigned char  class,
+             uint16_t       machine,
+             int            depth)
+{
+    char        buf[4096];
+    const char *dir;
+    const char *end;
+    size_t      len;
+
+    for (dir = dirs; dir; dir = (*end) ? end + 1 : NULL)
+    {
+        if (!(end = strchr (dir, ':')))
+        {
+            end = dir + strlen (dir);
+        }
+        len = (size_t) (end - dir);
+        if (len == 0)
+        {
+            continue;
+        }
+
+        if (strncmp (dir, "$ORIGIN", 7) == 0 && (len == 7 || dir[7] == '/'))
+        {
+            snprintf (buf, sizeof (buf), "%s%.*s/%s",
+                    origin, (int) (len - 7), dir + 7, lib);
+        }
+        else if (strncmp (dir, "${ORIGIN}", 9) == 0 && (len == 9 || dir[9] == '/'))
+        {
+            snprintf (buf, sizeof (buf), "%s%.*s/%s",
+                    origin, (int) (len - 9), dir + 9, lib);
+        }
+        else
+        {
+            snprintf (buf, sizeof (buf), "%.*s/%s", (int) len, dir, lib);
+        }
+
+        if (prefetch_file (pf, buf, class, machine, depth))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* resolves lib the same way the dynamic loader would (more or less: we use
+ * the RPATH of the object only, not of the whole chain) */
+static int
+prefetch_lib (prefetch_t    *pf,
+              const char    *lib,
+              const char    *origin,
+              elf_deps_t    *deps,
+              unsigned char  class,
+              uint16_t       machine,
+              int            depth)
+{
+    const char *s;
+    int         i;
+
+    if (strchr (lib, '/'))
+    {
+        return prefetch_file (pf, lib, class, machine, depth);
+    }
+
+    if (!deps->runpath && deps->rpath
+            && search_dirs (pf, deps->rpath, origin, lib, class, machine, depth))
+    {
+        return 1;
+    }
+    if ((s = getenv ("LD_LIBRARY_PATH"))
+            && search_dirs (pf, s, origin, lib, class, machine, depth))
+    {
+        return 1;
+    }
+    if (deps->runpath
+            && search_dirs (pf, deps->runpath, origin, lib, class, machine, depth))
+    {
+        return 1;
+    }
+    for (i = 0; i < pf->lib_dirs_len; ++i)
+    {
+        if (search_dirs (pf, pf->lib_dirs[i], origin, lib, class, machine, depth))
+        {
+            return 1;
+        }
+    }
+
+    p (LVL_DEBUG, "prefetch: library %s not found\n", lib);
+    return 0;
+}
+
+static void
+prefetch_elf_deps (prefetch_t          *pf,
+                   const char          *file,
+                   const unsigned char *map,
+                   size_t               size,
+                   unsigned char        class,
+                   uint16_t             machine,
+                   int                  depth)
+{
+    elf_deps_t  deps;
+    char       *origin;
+    char       *s;
+    int         i;
+
+    if (!elf_get_deps (map, size, class, &deps))
+    {
+        return;
+    }
+
+    if (deps.interp)
+    {
+        prefetch_file (pf, deps.interp, 0, 0, depth + 1);
+    }
+
+    if (deps.nb_needed > 0)
+    {
+        /* $ORIGIN is the folder of the actual file, after symlinks */
+        if ((origin = realpath (file, NULL)) && (s = strrchr (origin, '/')))
+        {
+            *s = '\0';
+        }
+        for (i = 0; i < deps.nb_needed; ++i)
+        {
+            prefetch_lib (pf, deps.needed[i], (origin) ? origin : "",
+                    &deps, class, machine, depth + 1);
+        }
+        free (origin);
+    }
+    free (deps.needed);
+}
+
+static void
+prefetch_shebang (prefetch_t          *pf,
+                  const unsigned char *map,
+                  size_t               size,
+                  int                  depth)
+{
+    char  buf[MAX_SHEBANG];
+    char *interp;
+    char *arg;
+    char *s;
+    char *saveptr;
+    size_t l;
+
+    l = (size - 2 < sizeof (buf) - 1) ? size - 2 : sizeof (buf) - 1;
+    memcpy (buf, map + 2, l);
+    buf[l] = '\0';
+    if ((s = strchr (buf, '\n')))
+    {
+        *s = '\0';
+    }
+
+    if (!(interp = strtok_r (buf, " \t", &saveptr)))
+    {
+        return;
+    }
+    prefetch_file (pf, interp, 0, 0, depth + 1);
+
+    /* #!/usr/bin/env foo: prefetch foo as well */
+    l = strlen (interp);
+    if (l >= 4 && strcmp (interp + l - 4, "/env") == 0
+            && (arg = strtok_r (NULL, " \t", &saveptr)) && *arg != '-')
+    {
+        if ((s = find_in_path (arg)))
+        {
+            prefetch_file (pf, s, 0, 0, depth + 1);
+            free (s);
+        }
+    }
+}
+
+/* readahead file, and if class is set only do so if it's an ELF of said
+ * class & machine (i.e. a library the loader would use). Returns 1 if the file
+ * was a match (even if already prefetched), else 0 */
+static int
+prefetch_file (prefetch_t    *pf,
+               const char    *file,
+               unsigned char  class,
+               uint16_t       machine,
+               int            depth)
+{
+    struct stat    statbuf;
+    unsigned char  f_class     = 0;
+    uint16_t       f_machine   = 0;
+    unsigned char *map;
+    size_t         size;
+    int            is_elf;
+    int            fd;
+
+    if ((fd = open (file, O_RDONLY | O_CLOEXEC)) < 0)
+    {
+        return 0;
+    }
+    if (fstat (fd, &statbuf) < 0 || !S_ISREG (statbuf.st_mode))
+    {
+        close (fd);
+        return 0;
+    }
+    is_elf = read_elf_id (fd, &f_class, &f_machine);
+    if (class && (!is_elf || f_class != class || f_machine != machine))
+    {
+        close (fd);
+        return 0;
+    }
+    if (!mark_seen (pf, statbuf.st_dev, statbuf.st_ino))
+    {
+        close (fd);
+        return 1;
+    }
+
+    size = (size_t) statbuf.st_size;
+    p (LVL_DEBUG, "prefetch: %s (%lu bytes)\n", file, (unsigned long) size);
+#ifdef HAVE_READAHEAD
+    if (readahead (fd, 0, size) < 0)
+#endif
+    {
+#ifdef HAVE_POSIX_FADVISE
+        posix_fadvise (fd, 0, statbuf.st_size, POSIX_FADV_WILLNEED);
+#endif
+    }
+    ++pf->nb_files;
+    pf->nb_bytes += size;
+
+    if (depth < MAX_DEPTH && size > 2)
+    {
+        map = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED)
+        {
+            if (is_elf)
+            {
+                prefetch_elf_deps (pf, file, map, size, f_class, f_machine, depth);
+            }
+            else if (map[0] == '#' && map[1] == '!')
+            {
+                prefetch_shebang (pf, map, size, depth);
+            }
+            munmap (map, size);
+        }
+    }
+
+    close (fd);
+    return 1;
+}
+
+static void *
+prefetch_thread (void *data)
+{
+    prefetch_t *pf = data;
+    entry_t    *entry;
+    char       *exe;
+    int         i;
+
+    load_lib_dirs (pf);
+
+    for (;;)
+    {
+        pthread_mutex_lock (&pf->mutex);
+        for (;;)
+        {
+            while (pf->next < pf->entries_len && pf->states[pf->next] != PF_QUEUED)
+            {
+                ++pf->next;
+            }
+            if (pf->next < pf->entries_len || pf->ended)
+            {
+                break;
+            }
+            pthread_cond_wait (&pf->cond, &pf->mutex);
+        }
+        /* in order, unless one is being waited on */
+        i = (pf->urgent >= 0 && pf->states[pf->urgent] == PF_QUEUED) ? pf->urgent
+            : pf->next;
+        pf->urgent = -1;
+        entry = (i < pf->entries_len) ? pf->entries[i] : NULL;
+        if (entry)
+        {
+            pf->states[i] = PF_BUSY;
+        }
+        pthread_mutex_unlock (&pf->mutex);
+        if (!entry)
+        {
+            break;
+        }
+
+        if (strchr (entry->argv[0], '/'))
+        {
+            exe = strdup (entry->argv[0]);
+        }
+        else
+        {
+            exe = find_in_path (entry->argv[0]);
+        }
+
+        if (exe)
+        {
+            p (LVL_DEBUG, "prefetch: %s: executable %s\n", entry->name, exe);
+            prefetch_file (pf, exe, 0, 0, 0);
+            free (exe);
+        }
+        else
+        {
+            p (LVL_DEBUG, "prefetch: %s: %s not found\n", entry->name, entry->argv[0]);
+        }
+
+        pthread_mutex_lock (&pf->mutex);
+        pf->states[i] = PF_DONE;
+        pthread_cond_broadcast (&pf->cond);
+        pthread_mutex_unlock (&pf->mutex);
+    }
+
+    return NULL;
+}
+
+prefetch_t *
+prefetch_start (void)
+{
+    prefetch_t *pf;
+    int         r;
+
+    pf = calloc (1, sizeof (*pf));
+    pf->urgent = -1;
+    pthread_mutex_init (&pf->mutex, NULL);
+    pthread_cond_init (&pf->cond, NULL);
+    clock_gettime (CLOCK_MONOTONIC, &pf->ts_start);
+
+    if ((r = start_thread (&pf->thread, prefetch_thread, pf)) != 0)
+    {
+        p (LVL_ERROR, "prefetch: unable to create thread: %s\n", strerror (r));
+        pthread_cond_destroy (&pf->cond);
+        pthread_mutex_destroy (&pf->mutex);
+        free (pf);
+        return NULL;
+    }
+    return pf;
+}
+
+/* queue entry to be prefetched; returns its index, for prefetch_wait() */
+int
+prefetch_add (prefetch_t *pf, entry_t *entry)
+{
+    int index;
+
+    pthread_mutex_lock (&pf->mutex);
+    if (pf->entries_len == pf->entries_alloc)
+    {
+        pf->entries_alloc += 16;
+        pf->entries = realloc (pf->entries,
+                sizeof (*pf->entries) * (size_t) pf->entries_alloc);
+        pf->states = realloc (pf->states,
+                sizeof (*pf->states) * (size_t) pf->entries_alloc);
+    }
+    index = pf->entries_len;
+    pf->states[index] = PF_QUEUED;
+    pf->entries[pf->entries_len++] = entry;
+    pthread_cond_broadcast (&pf->cond);
+    pthread_mutex_unlock (&pf->mutex);
+
+    return index;
+}
+
+/* no more entries will be added */
+void
+prefetch_end (prefetch_t *pf)
+{
+    pthread_mutex_lock (&pf->mutex);
+    pf->ended = 1;
+    pthread_cond_broadcast (&pf->cond);
+    pthread_mutex_unlock (&pf->mutex);
+}
+
+/* have entry #index be prefetched next, unless already done/in progress, and
+ * waits for it up to MAX_WAIT ms: it's about to be started, and others
+ * (queued before) mustn't hold it up */
+void
+prefetch_wait (prefetch_t *pf, int index)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_REALTIME, &ts);
+    ts.tv_nsec += MAX_WAIT * 1000000L;
+    if (ts.tv_nsec >= 1000000000)
+    {
+        ++ts.tv_sec;
+        ts.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock (&pf->mutex);
+    if (pf->states[index] == PF_QUEUED)
+    {
+        pf->urgent = index;
+        pthread_cond_broadcast (&pf->cond);
+    }
+    while (pf->states[index] != PF_DONE
+            && pthread_cond_timedwait (&pf->cond, &pf->mutex, &ts) == 0)
+        ;
+    if (pf->states[index] != PF_DONE)
+    {
+        p (LVL_DEBUG, "prefetch: %s: not done yet, not waiting\n",
+                pf->entries[index]->name);
+    }
+    pthread_mutex_unlock (&pf->mutex);
+}
+
+void
+prefetch_finish (prefetch_t *pf)
+{
+    struct timespec ts;
+    long            ms;
+    int             i;
+
+    prefetch_end (pf);
+    pthread_join (pf->thread, NULL);
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    ms = (ts.tv_sec - pf->ts_start.tv_sec) * 1000
+        + (ts.tv_nsec - pf->ts_start.tv_nsec) / 1000000;
+    p (LVL_VERBOSE, "prefetched %u files (%lu KiB) in %ld ms\n",
+            pf->nb_files, pf->nb_bytes / 1024, ms);
+
+    for (i = 0; i < pf->lib_dirs_len; ++i)
+    {
+        free (pf->lib_dirs[i]);
+    }
+    free (pf->lib_dirs);
+    free (pf->entries);
+    free (pf->states);
+    free (pf->seen);
+    pthread_cond_destroy (&pf->cond);
+    pthread_mutex_destroy (&pf->mutex);
+    free (pf);
+}
@@ -0,0 +1,36 @@
+/**
+ * dapper - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * prefetch.h
+ * Copyright (C) 2012-2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of dapper.
+ *
+ * dapper is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * dapper is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * dapper. If not, see http://www.gnu.org/licenses/
+ */
+
+#ifndef __PREFETCH_H__
+#define __PREFETCH_H__
+
+#include "dapper.h"
+
+typedef struct _prefetch_t prefetch_t;
+
+prefetch_t *prefetch_start  (void);
+int         prefetch_add    (prefetch_t *pf, entry_t *entry);
+void        prefetch_end    (prefetch_t *pf);
+void        prefetch_wait   (prefetch_t *pf, int index);
+void        prefetch_finish (prefetch_t *pf);
+
+#endif /* __PREFETCH_H__ */
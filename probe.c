@@ -0,0 +1,353 @@
+/**
+ * dapper - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * probe.c
+ * Copyright (C) 2012-2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of dapper.
+ *
+ * dapper is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * dapper is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * dapper. If not, see http://www.gnu.org/licenses/
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "config.h"
+#include "dapper.h"
+#include "probe.h"
+
+/* workers are only added when none is idle, e.g. all stuck on a hung mount */
+#define MAX_WORKERS     8
+#define MOUNTINFO       "/proc/self/mountinfo"
+
+typedef struct _job_t
+{
+    char           *path;
+    int             result;     /* -1 while pending, else 0 or 1 */
+    int             started;
+    int             abandoned;  /* timed out; to be free-d by the worker */
+    struct _job_t  *next;
+} job_t;
+
+/* probes are done from the parse, prefetch & main threads alike */
+static struct
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond_job;       /* a job was queued */
+    pthread_cond_t  cond_done;      /* a job is done */
+    job_t          *first;
+    job_t          *last;
+    int             nb_workers;
+    int             nb_idle;
+    int             timeout;        /* in ms, 0 for direct (blocking) probes */
+    char          **slow;           /* mount points that timed out */
+    int             nb_slow;
+} pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+    PTHREAD_COND_INITIALIZER, NULL, NULL, 0, 0, 0, NULL, 0 };
+
+static void
+free_job (job_t *job)
+{
+    free (job->path);
+    free (job);
+}
+
+static void *
+worker (void *arg)
+{
+    job_t *job;
+    int    r;
+
+    (void) arg;
+    pthread_mutex_lock (&pool.mutex);
+    for (;;)
+    {
+        while (!pool.first)
+        {
+            ++pool.nb_idle;
+            pthread_cond_wait (&pool.cond_job, &pool.mutex);
+            --pool.nb_idle;
+        }
+        job = pool.first;
+        pool.first = job->next;
+        if (!pool.first)
+        {
+            pool.last = NULL;
+        }
+        job->started = 1;
+        pthread_mutex_unlock (&pool.mutex);
+
+        /* this is what might hang */
+        r = (access (job->path, F_OK | X_OK) == 0);
+
+        pthread_mutex_lock (&pool.mutex);
+        if (job->abandoned)
+        {
+            free_job (job);
+        }
+        else
+        {
+            job->result = r;
+            pthread_cond_broadcast (&pool.cond_done);
+        }
+    }
+    return NULL;
+}
+
+/* sets the per-probe timeout, in ms. With 0, probes are done directly */
+void
+probe_init (int timeout)
+{
+    pthread_condattr_t attr;
+
+    pool.timeout = timeout;
+    pthread_condattr_init (&attr);
+    pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+    pthread_cond_destroy (&pool.cond_done);
+    pthread_cond_init (&pool.cond_done, &attr);
+    pthread_condattr_destroy (&attr);
+}
+
+/* whether path is under a mount point known to be slow */
+static int
+is_slow (const char *path)
+{
+    size_t l;
+    int    i;
+
+    for (i = 0; i < pool.nb_slow; ++i)
+    {
+        l = strlen (pool.slow[i]);
+        if (strncmp (path, pool.slow[i], l) == 0
+                && (path[l] == '/' || path[l] == '\0' || l == 1))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* unescapes octal sequences (e.g. \040 for space) of mountinfo in place */
+static void
+unescape_mount (char *s)
+{
+    char *d = s;
+
+    for ( ; *s; ++s, ++d)
+    {
+        if (s[0] == '\\' && s[1] >= '0' && s[1] <= '7' && s[2] >= '0'
+                && s[2] <= '7' && s[3] >= '0' && s[3] <= '7')
+        {
+            *d = (char) (((s[1] - '0') << 6) | ((s[2] - '0') << 3) | (s[3] - '0'));
+            s += 3;
+        }
+        else
+        {
+            *d = *s;
+        }
+    }
+    *d = '\0';
+}
+
+/* whether fstype is one that can hang (rather than just be slow, e.g. a local
+ * disk under load): network filesystems & FUSE */
+static int
+is_remote (const char *fstype)
+{
+    static const char *remote[] = { "nfs", "nfs4", "cifs", "smb3", "smbfs",
+        "ncpfs", "9p", "afs", "ceph", "glusterfs", "lustre", "gfs2", "ocfs2",
+        "davfs", "fuse", "fuseblk", NULL };
+    int i;
+
+    if (strncmp (fstype, "fuse.", 5) == 0)
+    {
+        return 1;
+    }
+    for (i = 0; remote[i]; ++i)
+    {
+        if (strcmp (fstype, remote[i]) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* remembers the mount point path is on as slow, if it's a network or FUSE
+ * filesystem; a local one (e.g. on a cold disk under load) is never blamed,
+ * nor is the root filesystem. Reading mountinfo doesn't touch the mounted
+ * filesystems, so it won't hang */
+static void
+add_slow (const char *path)
+{
+    FILE   *fp;
+    char    buf[4096];
+    char   *best = NULL;
+    size_t  best_len = 0;
+    size_t  l;
+    char   *s;
+    char   *t;
+    int     remote = 0;
+    int     i;
+
+    if ((fp = fopen (MOUNTINFO, "r")))
+    {
+        while (fgets (buf, sizeof (buf), fp))
+        {
+            /* mount point is the 5th field */
+            s = buf;
+            for (i = 0; i < 4 && s; ++i)
+            {
+                if ((s = strchr (s, ' ')))
+                {
+                    ++s;
+                }
+            }
+            /* filesystem type is right after the " - " separator */
+            if (!s || !(t = strstr (s, " - ")) || !(s = strtok (s, " ")))
+            {
+                continue;
+            }
+            t += 3;
+            t[strcspn (t, " ")] = '\0';
+            unescape_mount (s);
+            l = strlen (s);
+            if (l > best_len && strncmp (path, s, l) == 0
+                    && (path[l] == '/' || path[l] == '\0' || l == 1))
+            {
+                free (best);
+                best = strdup (s);
+                best_len = l;
+                remote = is_remote (t);
+            }
+        }
+        fclose (fp);
+    }
+    if (!best || best_len == 1 || !remote)
+    {
+        p (LVL_VERBOSE, "%s: probe timed out\n", path);
+        free (best);
+        return;
+    }
+
+    p (LVL_ERROR, "%s: probe timed out, ignoring %s from now on\n", path, best);
+    pool.slow = realloc (pool.slow, sizeof (*pool.slow) * (size_t) (pool.nb_slow + 1));
+    pool.slow[pool.nb_slow++] = best;
+}
+
+/* returns 1 if path exists & is executable, 0 if not, -1 if that couldn't be
+ * known in time (i.e. it's on a slow/hung mount) */
+int
+probe_access (const char *path)
+{
+    struct timespec ts;
+    pthread_t       thread;
+    job_t          *job;
+    job_t          *prev;
+    int             r;
+
+    if (pool.timeout <= 0)
+    {
+        return (access (path, F_OK | X_OK) == 0);
+    }
+
+    pthread_mutex_lock (&pool.mutex);
+    if (is_slow (path))
+    {
+        pthread_mutex_unlock (&pool.mutex);
+        p (LVL_DEBUG, "%s: on slow mount, skipped\n", path);
+        return -1;
+    }
+
+    job = calloc (1, sizeof (*job));
+    job->path = strdup (path);
+    job->result = -1;
+    if (pool.last)
+    {
+        pool.last->next = job;
+    }
+    else
+    {
+        pool.first = job;
+    }
+    pool.last = job;
+    if (pool.nb_idle == 0 && pool.nb_workers < MAX_WORKERS)
+    {
+        /* workers outlive the parsing, so they mustn't get signals meant for
+         * the signalfd of launch.c */
+        if (start_thread (&thread, worker, NULL) == 0)
+        {
+            pthread_detach (thread);
+            ++pool.nb_workers;
+        }
+    }
+    pthread_cond_signal (&pool.cond_job);
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += pool.timeout / 1000;
+    ts.tv_nsec += (pool.timeout % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000)
+    {
+        ++ts.tv_sec;
+        ts.tv_nsec -= 1000000000;
+    }
+    while (job->result < 0
+            && pthread_cond_timedwait (&pool.cond_done, &pool.mutex, &ts) != ETIMEDOUT)
+        ;
+
+    if (job->result >= 0)
+    {
+        r = job->result;
+        free_job (job);
+    }
+    else if (!job->started)
+    {
+        /* all workers are stuck; it's not this path's fault */
+        prev = NULL;
+        if (pool.first != job)
+        {
+            for (prev = pool.first; prev->next != job; prev = prev->next)
+                ;
+        }
+        if (prev)
+        {
+            prev->next = job->next;
+        }
+        else
+        {
+            pool.first = job->next;
+        }
+        if (pool.last == job)
+        {
+            pool.last = prev;
+        }
+        free_job (job);
+        r = -1;
+    }
+    else
+    {
+        job->abandoned = 1;
+        add_slow (path);
+        r = -1;
+    }
+    pthread_mutex_unlock (&pool.mutex);
+
+    return r;
+}
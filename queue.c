@@ -0,0 +1,82 @@
+/**
+ * dapper - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * queue.c
+ * Copyright (C) 2012-2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of dapper.
+ *
+ * dapper is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * dapper is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * dapper. If not, see http://www.gnu.org/licenses/
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+
+#include "config.h"
+#include "queue.h"
+
+void
+queue_init (queue_t *queue, unsigned int size)
+{
+    unsigned int s;
+
+    for (s = 1; s < size; s <<= 1)
+        ;
+    queue->items = malloc (sizeof (*queue->items) * s);
+    queue->size = s;
+    queue->head = 0;
+    queue->tail = 0;
+    sem_init (&queue->filled, 0, 0);
+    sem_init (&queue->empty, 0, s);
+}
+
+/* blocks while the queue is full */
+void
+queue_push (queue_t *queue, void *item)
+{
+    unsigned int tail;
+
+    while (sem_wait (&queue->empty) < 0 && errno == EINTR)
+        ;
+    tail = __atomic_load_n (&queue->tail, __ATOMIC_RELAXED);
+    queue->items[tail & (queue->size - 1)] = item;
+    __atomic_store_n (&queue->tail, tail + 1, __ATOMIC_RELEASE);
+    sem_post (&queue->filled);
+}
+
+/* blocks while the queue is empty */
+void *
+queue_pop (queue_t *queue)
+{
+    unsigned int  head;
+    void         *item;
+
+    while (sem_wait (&queue->filled) < 0 && errno == EINTR)
+        ;
+    head = __atomic_load_n (&queue->head, __ATOMIC_RELAXED);
+    /* make sure we see the item written before tail was updated */
+    (void) __atomic_load_n (&queue->tail, __ATOMIC_ACQUIRE);
+    item = queue->items[head & (queue->size - 1)];
+    __atomic_store_n (&queue->head, head + 1, __ATOMIC_RELEASE);
+    sem_post (&queue->empty);
+    return item;
+}
+
+void
+queue_destroy (queue_t *queue)
+{
+    sem_destroy (&queue->filled);
+    sem_destroy (&queue->empty);
+    free (queue->items);
+}
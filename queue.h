@@ -0,0 +1,45 @@
+/**
+ * dapper - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * queue.h
+ * Copyright (C) 2012-2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of dapper.
+ *
+ * dapper is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * dapper is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * dapper. If not, see http://www.gnu.org/licenses/
+ */
+
+#ifndef __QUEUE_H__
+#define __QUEUE_H__
+
+#include <semaphore.h>
+
+/* bounded single-producer/single-consumer queue. The ring itself is
+ * lock-free, the semaphores are only used to sleep when empty/full */
+typedef struct
+{
+    void         **items;
+    unsigned int   size;    /* always a power of 2 */
+    unsigned int   head;    /* only written by the consumer */
+    unsigned int   tail;    /* only written by the producer */
+    sem_t          filled;
+    sem_t          empty;
+} queue_t;
+
+void  queue_init    (queue_t *queue, unsigned int size);
+void  queue_push    (queue_t *queue, void *item);
+void *queue_pop     (queue_t *queue);
+void  queue_destroy (queue_t *queue);
+
+#endif /* __QUEUE_H__ */
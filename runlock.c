@@ -0,0 +1,202 @@
+/**
+ * dapper - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * runlock.c
+ * Copyright (C) 2012-2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of dapper.
+ *
+ * dapper is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * dapper is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * dapper. If not, see http://www.gnu.org/licenses/
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "config.h"
+#include "dapper.h"
+#include "runlock.h"
+
+/* The lock file is also where the launch set is published: a line "#dapper"
+ * (so an empty set still counts), then names of all entries started (or found
+ * running), one per line. It's held from before scanning until the set is
+ * known, so a concurrent dapper waits for it */
+struct _runlock_t
+{
+    int     fd;                 /* -1 once published */
+    char   *set;                /* previously published, NUL-separated */
+    size_t  len;
+};
+
+static void
+read_set (runlock_t *lock)
+{
+    struct stat statbuf;
+    ssize_t     n;
+    size_t      i;
+
+    if (fstat (lock->fd, &statbuf) < 0 || statbuf.st_size == 0)
+    {
+        return;
+    }
+    lock->set = malloc ((size_t) statbuf.st_size + 1);
+    while (lock->len < (size_t) statbuf.st_size
+            && (n = pread (lock->fd, lock->set + lock->len,
+                    (size_t) statbuf.st_size - lock->len, (off_t) lock->len)) > 0)
+    {
+        lock->len += (size_t) n;
+    }
+    lock->set[lock->len] = '\0';
+    for (i = 0; i < lock->len; ++i)
+    {
+        if (lock->set[i] == '\n')
+        {
+            lock->set[i] = '\0';
+        }
+    }
+}
+
+/* takes the run lock for this session, as per policy. Sets done if there's
+ * nothing else to do, i.e. another dapper was/is taking care of it. Returns
+ * NULL if there's no lock (to be) held, e.g. on error */
+runlock_t *
+runlock_acquire (runlock_policy_t policy, int *done)
+{
+    runlock_t *lock;
+    char       path[PATH_MAX];
+    int        fd;
+
+    *done = 0;
+    if (!get_runtime_file (path, sizeof (path), "lock"))
+    {
+        p (LVL_ERROR, "unable to get path of run lock\n");
+        return NULL;
+    }
+    if ((fd = open (path, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) < 0)
+    {
+        p (LVL_ERROR, "unable to open %s: %s\n", path, strerror (errno));
+        return NULL;
+    }
+
+    if (flock (fd, LOCK_EX | LOCK_NB) < 0)
+    {
+        if (errno != EWOULDBLOCK)
+        {
+            p (LVL_ERROR, "unable to lock %s: %s\n", path, strerror (errno));
+            close (fd);
+            return NULL;
+        }
+        if (policy == RUNLOCK_EXIT)
+        {
+            p (LVL_VERBOSE, "another dapper is running, exiting\n");
+            close (fd);
+            *done = 1;
+            return NULL;
+        }
+        p (LVL_VERBOSE, "another dapper is running, waiting for it\n");
+        while (flock (fd, LOCK_EX) < 0)
+        {
+            if (errno != EINTR)
+            {
+                p (LVL_ERROR, "unable to lock %s: %s\n", path, strerror (errno));
+                close (fd);
+                return NULL;
+            }
+        }
+    }
+
+    lock = calloc (1, sizeof (*lock));
+    lock->fd = fd;
+    read_set (lock);
+    if (lock->len > 0 && policy != RUNLOCK_MERGE)
+    {
+        char *s;
+
+        p (LVL_VERBOSE, "already done in this session, exiting\n");
+        for (s = lock->set; s < lock->set + lock->len; s += strlen (s) + 1)
+        {
+            if (*s != '#')
+            {
+                p (LVL_VERBOSE, "launched: %s\n", s);
+            }
+        }
+        runlock_free (lock);
+        *done = 1;
+        return NULL;
+    }
+    return lock;
+}
+
+/* whether name is part of the launch set already published */
+int
+runlock_has (runlock_t *lock, const char *name)
+{
+    char *s;
+
+    for (s = lock->set; s && s < lock->set + lock->len; s += strlen (s) + 1)
+    {
+        if (strcmp (s, name) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* adds entries to the launch set, and releases the lock */
+void
+runlock_publish (runlock_t *lock, entry_t *entries)
+{
+    FILE *fp;
+
+    if (lock->fd < 0)
+    {
+        return;
+    }
+    lseek (lock->fd, 0, SEEK_END);
+    if ((fp = fdopen (lock->fd, "a")))
+    {
+        fprintf (fp, "#dapper\n");
+        for ( ; entries; entries = entries->next)
+        {
+            fprintf (fp, "%s\n", entries->name);
+        }
+        /* also releases the lock */
+        fclose (fp);
+    }
+    else
+    {
+        close (lock->fd);
+    }
+    lock->fd = -1;
+}
+
+void
+runlock_free (runlock_t *lock)
+{
+    if (lock->fd >= 0)
+    {
+        close (lock->fd);
+    }
+    free (lock->set);
+    free (lock);
+}
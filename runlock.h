@@ -0,0 +1,44 @@
+/**
+ * dapper - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * runlock.h
+ * Copyright (C) 2012-2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of dapper.
+ *
+ * dapper is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * dapper is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * dapper. If not, see http://www.gnu.org/licenses/
+ */
+
+#ifndef __RUNLOCK_H__
+#define __RUNLOCK_H__
+
+#include "dapper.h"
+
+/* what to do when another dapper was/is run in the same session */
+typedef enum
+{
+    RUNLOCK_NONE = 0,
+    RUNLOCK_EXIT,               /* exit right away */
+    RUNLOCK_WAIT,               /* wait for its launch set, then exit */
+    RUNLOCK_MERGE,              /* wait, then only start what it didn't */
+} runlock_policy_t;
+
+typedef struct _runlock_t runlock_t;
+
+runlock_t *runlock_acquire (runlock_policy_t policy, int *done);
+int        runlock_has     (runlock_t *lock, const char *name);
+void       runlock_publish (runlock_t *lock, entry_t *entries);
+void       runlock_free    (runlock_t *lock);
+
+#endif /* __RUNLOCK_H__ */
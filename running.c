@@ -0,0 +1,318 @@
+/**
+ * dapper - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * running.c
+ * Copyright (C) 2012-2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of dapper.
+ *
+ * dapper is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * dapper is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * dapper. If not, see http://www.gnu.org/licenses/
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+
+#include "config.h"
+#include "dapper.h"
+#include "running.h"
+
+/* max size of a command line we'll look at */
+#define MAX_CMDLINE     (64 * 1024)
+
+/* a process, identified by its executable and arguments (argv[0] excluded,
+ * since it doesn't have to be the executable's path) */
+typedef struct
+{
+    uint32_t    hash;
+    char       *exe;
+    char       *args;       /* NUL-separated */
+    size_t      len_args;
+} process_t;
+
+struct _running_t
+{
+    process_t  *procs;      /* hash table, open addressing */
+    uint32_t    size;       /* always a power of 2 */
+    uint32_t    len;
+};
+
+/* FNV-1a, over exe (with its NUL) then args */
+static uint32_t
+hash_process (const char *exe, const char *args, size_t len_args)
+{
+    uint32_t    h = 2166136261u;
+    const char *s;
+    size_t      i;
+
+    for (s = exe; ; ++s)
+    {
+        h = (h ^ (unsigned char) *s) * 16777619u;
+        if (!*s)
+        {
+            break;
+        }
+    }
+    for (i = 0; i < len_args; ++i)
+    {
+        h = (h ^ (unsigned char) args[i]) * 16777619u;
+    }
+    return h;
+}
+
+static void
+add_process (running_t *running, const char *exe, const char *args, size_t len_args)
+{
+    process_t *proc;
+    uint32_t   hash;
+    uint32_t   i;
+
+    if ((running->len + 1) * 2 > running->size)
+    {
+        process_t *old = running->procs;
+        uint32_t   old_size = running->size;
+
+        running->size = (old_size) ? old_size * 2 : 256;
+        running->procs = calloc (running->size, sizeof (*running->procs));
+        for (i = 0; i < old_size; ++i)
+        {
+            if (old[i].exe)
+            {
+                uint32_t j = old[i].hash & (running->size - 1);
+
+                while (running->procs[j].exe)
+                {
+                    j = (j + 1) & (running->size - 1);
+                }
+                running->procs[j] = old[i];
+            }
+        }
+        free (old);
+    }
+
+    hash = hash_process (exe, args, len_args);
+    for (i = hash & (running->size - 1); running->procs[i].exe;
+            i = (i + 1) & (running->size - 1))
+    {
+        proc = &running->procs[i];
+        if (proc->hash == hash && proc->len_args == len_args
+                && strcmp (proc->exe, exe) == 0
+                && memcmp (proc->args, args, len_args) == 0)
+        {
+            /* already known (e.g. multiple instances) */
+            return;
+        }
+    }
+    proc = &running->procs[i];
+    proc->hash = hash;
+    proc->exe = strdup (exe);
+    proc->args = malloc (len_args + 1);
+    memcpy (proc->args, args, len_args);
+    proc->len_args = len_args;
+    ++running->len;
+}
+
+static int
+read_cmdline (int dirfd, char *buf, size_t size, size_t *len)
+{
+    ssize_t r;
+    int     fd;
+
+    if ((fd = openat (dirfd, "cmdline", O_RDONLY | O_CLOEXEC)) < 0)
+    {
+        return 0;
+    }
+    *len = 0;
+    while (*len < size && (r = read (fd, buf + *len, size - *len)) > 0)
+    {
+        *len += (size_t) r;
+    }
+    close (fd);
+    return *len > 0;
+}
+
+/* builds the list of processes of the current user, in one sweep of /proc */
+running_t *
+running_scan (void)
+{
+    running_t      *running;
+    struct timespec ts_start;
+    struct timespec ts_end;
+    struct dirent  *dirent;
+    struct stat     st;
+    DIR            *dp;
+    char            exe[PATH_MAX];
+    char           *cmdline;
+    char           *args;
+    size_t          len;
+    ssize_t         l;
+    uid_t           uid = getuid ();
+    pid_t           self = getpid ();
+    int             nb = 0;
+    int             fd;
+
+    running = calloc (1, sizeof (*running));
+    clock_gettime (CLOCK_MONOTONIC, &ts_start);
+    if (!(dp = opendir ("/proc")))
+    {
+        p (LVL_ERROR, "failed to open /proc: %s\n", strerror (errno));
+        return running;
+    }
+
+    cmdline = malloc (MAX_CMDLINE);
+    while ((dirent = readdir (dp)))
+    {
+        if (!isdigit (dirent->d_name[0]) || atoi (dirent->d_name) == self)
+        {
+            continue;
+        }
+        if ((fd = openat (dirfd (dp), dirent->d_name,
+                        O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+        {
+            continue;
+        }
+        ++nb;
+        /* kernel threads have no exe */
+        if (fstat (fd, &st) < 0 || st.st_uid != uid
+                || (l = readlinkat (fd, "exe", exe, sizeof (exe) - 1)) <= 0
+                || !read_cmdline (fd, cmdline, MAX_CMDLINE, &len))
+        {
+            close (fd);
+            continue;
+        }
+        close (fd);
+        exe[l] = '\0';
+        /* 10 = strlen (" (deleted)"), e.g. after an upgrade */
+        if (l > 10 && strcmp (exe + l - 10, " (deleted)") == 0)
+        {
+            exe[l - 10] = '\0';
+        }
+
+        /* skip argv[0] */
+        args = memchr (cmdline, '\0', len);
+        args = (args) ? args + 1 : cmdline + len;
+        add_process (running, exe, args, len - (size_t) (args - cmdline));
+
+        /* for scripts, the exe is the interpreter, so also add what it runs:
+         * e.g. "python3 /usr/bin/foo --bar" as /usr/bin/foo with --bar */
+        if (args < cmdline + len && *args == '/')
+        {
+            char *script = args;
+
+            args = memchr (args, '\0', len - (size_t) (args - cmdline));
+            args = (args) ? args + 1 : cmdline + len;
+            if (realpath (script, exe))
+            {
+                add_process (running, exe, args, len - (size_t) (args - cmdline));
+            }
+        }
+    }
+    closedir (dp);
+    free (cmdline);
+
+    clock_gettime (CLOCK_MONOTONIC, &ts_end);
+    p (LVL_VERBOSE, "scanned %d processes (%u running commands) in %ld us\n",
+            nb, running->len,
+            (ts_end.tv_sec - ts_start.tv_sec) * 1000000
+            + (ts_end.tv_nsec - ts_start.tv_nsec) / 1000);
+    return running;
+}
+
+/* returns whether command line argv is already running, i.e. its executable
+ * (as resolved from PATH, symlinks resolved) with the same arguments */
+int
+running_has (running_t *running, char **argv)
+{
+    process_t *proc;
+    char       exe[PATH_MAX];
+    char      *path;
+    char      *args;
+    char      *s;
+    size_t     len_args = 0;
+    uint32_t   hash;
+    uint32_t   i;
+    int        found = 0;
+    int        j;
+
+    if (running->len == 0)
+    {
+        return 0;
+    }
+
+    path = (strchr (argv[0], '/')) ? argv[0] : find_in_path (argv[0]);
+    if (!path || !realpath (path, exe))
+    {
+        if (path != argv[0])
+        {
+            free (path);
+        }
+        return 0;
+    }
+    if (path != argv[0])
+    {
+        free (path);
+    }
+
+    for (j = 1; argv[j]; ++j)
+    {
+        len_args += strlen (argv[j]) + 1;
+    }
+    args = s = malloc (len_args + 1);
+    for (j = 1; argv[j]; ++j)
+    {
+        s = stpcpy (s, argv[j]) + 1;
+    }
+
+    hash = hash_process (exe, args, len_args);
+    for (i = hash & (running->size - 1); running->procs[i].exe;
+            i = (i + 1) & (running->size - 1))
+    {
+        proc = &running->procs[i];
+        if (proc->hash == hash && proc->len_args == len_args
+                && strcmp (proc->exe, exe) == 0
+                && memcmp (proc->args, args, len_args) == 0)
+        {
+            found = 1;
+            break;
+        }
+    }
+
+    free (args);
+    return found;
+}
+
+void
+running_free (running_t *running)
+{
+    uint32_t i;
+
+    for (i = 0; i < running->size; ++i)
+    {
+        free (running->procs[i].exe);
+        free (running->procs[i].args);
+    }
+    free (running->procs);
+    free (running);
+}
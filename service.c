@@ -0,0 +1,452 @@
+/**
+ * dapper - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * service.c
+ * Copyright (C) 2012-2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of dapper.
+ *
+ * dapper is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * dapper is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * dapper. If not, see http://www.gnu.org/licenses/
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/signalfd.h>
+#include <sys/un.h>
+
+#include "config.h"
+#include "dapper.h"
+#include "service.h"
+
+/* how long a client has to send its request, in seconds */
+#define REQUEST_TIMEOUT     2
+
+/* there's one per user, not per session */
+static int
+get_path (struct sockaddr_un *addr)
+{
+    const char *dir = getenv ("XDG_RUNTIME_DIR");
+
+    memset (addr, 0, sizeof (*addr));
+    addr->sun_family = AF_UNIX;
+    if (!dir)
+    {
+        p (LVL_ERROR, "XDG_RUNTIME_DIR not set\n");
+        return 0;
+    }
+    if ((size_t) snprintf (addr->sun_path, sizeof (addr->sun_path),
+                "%s/dapper.service", dir) >= sizeof (addr->sun_path))
+    {
+        p (LVL_ERROR, "socket path too long\n");
+        return 0;
+    }
+    return 1;
+}
+
+static int
+read_all (int fd, void *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0)
+    {
+        if ((n = read (fd, buf, len)) <= 0)
+        {
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            return 0;
+        }
+        buf = (char *) buf + n;
+        len -= (size_t) n;
+    }
+    return 1;
+}
+
+/* reads a request from fd, with the fds for stdout & stderr; payload is
+ * alloc-ed, with req pointing into it */
+static char *
+read_request (int fd, service_req_t *req, int fds[2])
+{
+    union
+    {
+        char            buf[CMSG_SPACE (2 * sizeof (int))];
+        struct cmsghdr  align;
+    } control;
+    struct msghdr    msg;
+    struct iovec     iov;
+    struct cmsghdr  *cmsg;
+    service_hdr_t    hdr;
+    char            *payload;
+    char            *s;
+    char            *end;
+    int              nb;
+
+    memset (&msg, 0, sizeof (msg));
+    iov.iov_base = &hdr;
+    iov.iov_len = sizeof (hdr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof (control.buf);
+    if (recvmsg (fd, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC) != sizeof (hdr))
+    {
+        return NULL;
+    }
+    for (cmsg = CMSG_FIRSTHDR (&msg); cmsg; cmsg = CMSG_NXTHDR (&msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS
+                && cmsg->cmsg_len == CMSG_LEN (2 * sizeof (int)))
+        {
+            memcpy (fds, CMSG_DATA (cmsg), 2 * sizeof (int));
+        }
+    }
+
+    if (memcmp (hdr.magic, SERVICE_MAGIC, 4) != 0 || hdr.len == 0
+            || hdr.len > SERVICE_MAX_LEN
+            || (hdr.op != SERVICE_AUTOSTART && hdr.op != SERVICE_LAUNCH))
+    {
+        p (LVL_ERROR, "invalid request\n");
+        return NULL;
+    }
+    payload = malloc (hdr.len);
+    if (!read_all (fd, payload, hdr.len) || payload[hdr.len - 1] != '\0')
+    {
+        free (payload);
+        return NULL;
+    }
+
+    /* name, then environment */
+    end = payload + hdr.len;
+    for (nb = 0, s = payload; s < end; s += strlen (s) + 1)
+    {
+        ++nb;
+    }
+    req->env = calloc ((size_t) nb, sizeof (*req->env));
+    req->name = payload;
+    for (nb = 0, s = payload + strlen (payload) + 1; s < end; s += strlen (s) + 1)
+    {
+        req->env[nb++] = s;
+    }
+    req->op = hdr.op;
+    req->dry_run = hdr.flags & SERVICE_DRY_RUN;
+    req->verbose = hdr.verbose;
+    return payload;
+}
+
+static void
+send_reply (int fd, int status)
+{
+    service_hdr_t hdr;
+
+    memset (&hdr, 0, sizeof (hdr));
+    memcpy (hdr.magic, SERVICE_MAGIC, 4);
+    hdr.op = SERVICE_REPLY;
+    hdr.flags = (uint8_t) status;
+    if (write (fd, &hdr, sizeof (hdr)) != sizeof (hdr))
+    {
+        p (LVL_ERROR, "unable to send reply: %s\n", strerror (errno));
+    }
+}
+
+/* forks a process to take care of the request on fd, so we're never blocked
+ * (e.g. waiting on readiness), and launched applications don't end up being
+ * our children */
+static void
+serve (int fd, service_fn fn, void *data, const sigset_t *old_mask)
+{
+    struct timeval tv = { REQUEST_TIMEOUT, 0 };
+    service_req_t  req;
+    char          *payload;
+    int            fds[2] = { -1, -1 };
+    int            status;
+    pid_t          pid;
+
+    memset (&req, 0, sizeof (req));
+    /* so an idle client doesn't block everyone else */
+    setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+    if (!(payload = read_request (fd, &req, fds)))
+    {
+        goto done;
+    }
+
+    /* not to have the child write out our buffers again */
+    fflush (stdout);
+    fflush (stderr);
+    if ((pid = fork ()) == 0)
+    {
+        sigprocmask (SIG_SETMASK, old_mask, NULL);
+        if (fds[0] >= 0)
+        {
+            dup2 (fds[0], 1);
+        }
+        if (fds[1] >= 0)
+        {
+            dup2 (fds[1], 2);
+        }
+        clearenv ();
+        for (status = 0; req.env[status]; ++status)
+        {
+            putenv (req.env[status]);
+        }
+        status = fn (&req, data);
+        fflush (stdout);
+        fflush (stderr);
+        send_reply (fd, status);
+        _exit (status);
+    }
+    else if (pid < 0)
+    {
+        p (LVL_ERROR, "unable to fork: %s\n", strerror (errno));
+        send_reply (fd, 1);
+    }
+
+done:
+    free (payload);
+    free (req.env);
+    if (fds[0] >= 0)
+    {
+        close (fds[0]);
+    }
+    if (fds[1] >= 0)
+    {
+        close (fds[1]);
+    }
+    close (fd);
+}
+
+/* listens for requests until SIGTERM or SIGINT. Returns the exit status */
+int
+service_run (service_fn fn, service_reload reload, void *data)
+{
+    struct signalfd_siginfo si;
+    struct sockaddr_un      addr;
+    struct pollfd           pfds[2];
+    sigset_t                mask;
+    sigset_t                old_mask;
+    int                     fd;
+    int                     sigfd;
+    int                     running = 1;
+
+    if (!get_path (&addr))
+    {
+        return 1;
+    }
+    if ((fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+    {
+        p (LVL_ERROR, "unable to create socket: %s\n", strerror (errno));
+        return 1;
+    }
+    /* don't steal the socket of a running service, only replace a stale one */
+    if (connect (fd, (struct sockaddr *) &addr, sizeof (addr)) == 0
+            || (errno != ECONNREFUSED && errno != ENOENT))
+    {
+        p (LVL_ERROR, "service already running on %s\n", addr.sun_path);
+        close (fd);
+        return 1;
+    }
+    if (errno == ECONNREFUSED)
+    {
+        unlink (addr.sun_path);
+    }
+    if (bind (fd, (struct sockaddr *) &addr, sizeof (addr)) < 0
+            || listen (fd, SOMAXCONN) < 0)
+    {
+        p (LVL_ERROR, "unable to listen on %s: %s\n", addr.sun_path, strerror (errno));
+        close (fd);
+        return 1;
+    }
+
+    sigemptyset (&mask);
+    sigaddset (&mask, SIGCHLD);
+    sigaddset (&mask, SIGHUP);
+    sigaddset (&mask, SIGTERM);
+    sigaddset (&mask, SIGINT);
+    sigprocmask (SIG_BLOCK, &mask, &old_mask);
+    if ((sigfd = signalfd (-1, &mask, SFD_CLOEXEC)) < 0)
+    {
+        p (LVL_ERROR, "unable to create signalfd: %s\n", strerror (errno));
+        close (fd);
+        unlink (addr.sun_path);
+        return 1;
+    }
+
+    p (LVL_VERBOSE, "service listening on %s\n", addr.sun_path);
+    pfds[0].fd = fd;
+    pfds[0].events = POLLIN;
+    pfds[1].fd = sigfd;
+    pfds[1].events = POLLIN;
+    while (running)
+    {
+        if (poll (pfds, 2, -1) < 0)
+        {
+            continue;
+        }
+        if (pfds[1].revents & POLLIN
+                && read (sigfd, &si, sizeof (si)) == sizeof (si))
+        {
+            if (si.ssi_signo == SIGCHLD)
+            {
+                while (waitpid (-1, NULL, WNOHANG) > 0)
+                    ;
+            }
+            else if (si.ssi_signo == SIGHUP)
+            {
+                p (LVL_VERBOSE, "reloading\n");
+                reload (data);
+            }
+            else
+            {
+                running = 0;
+            }
+        }
+        if (running && pfds[0].revents & POLLIN)
+        {
+            int cfd = accept4 (fd, NULL, NULL, SOCK_CLOEXEC);
+
+            if (cfd >= 0)
+            {
+                serve (cfd, fn, data, &old_mask);
+            }
+        }
+    }
+
+    close (sigfd);
+    close (fd);
+    unlink (addr.sun_path);
+    sigprocmask (SIG_SETMASK, &old_mask, NULL);
+    return 0;
+}
+
+/* sends a request to the service, with our stdout/stderr & environment, and
+ * returns its exit status */
+int
+service_request (int op, const char *name, int dry_run)
+{
+    union
+    {
+        char            buf[CMSG_SPACE (2 * sizeof (int))];
+        struct cmsghdr  align;
+    } control;
+    struct sockaddr_un  addr;
+    struct msghdr       msg;
+    struct iovec        iov[2];
+    struct cmsghdr     *cmsg;
+    service_hdr_t       hdr;
+    char               *payload;
+    char               *s;
+    size_t              len;
+    ssize_t             n;
+    int                 fds[2] = { 1, 2 };
+    int                 fd;
+    int                 i;
+
+    if (!get_path (&addr))
+    {
+        return 1;
+    }
+    if ((fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0
+            || connect (fd, (struct sockaddr *) &addr, sizeof (addr)) < 0)
+    {
+        p (LVL_ERROR, "unable to connect to service on %s: %s\n",
+                addr.sun_path, strerror (errno));
+        if (fd >= 0)
+        {
+            close (fd);
+        }
+        return 1;
+    }
+
+    len = strlen (name) + 1;
+    for (i = 0; environ[i]; ++i)
+    {
+        len += strlen (environ[i]) + 1;
+    }
+    if (len > SERVICE_MAX_LEN)
+    {
+        p (LVL_ERROR, "request too large\n");
+        close (fd);
+        return 1;
+    }
+    s = payload = malloc (len);
+    s = stpcpy (s, name) + 1;
+    for (i = 0; environ[i]; ++i)
+    {
+        s = stpcpy (s, environ[i]) + 1;
+    }
+
+    memset (&hdr, 0, sizeof (hdr));
+    memcpy (hdr.magic, SERVICE_MAGIC, 4);
+    hdr.op = (uint8_t) op;
+    hdr.flags = (dry_run) ? SERVICE_DRY_RUN : 0;
+    hdr.verbose = (int8_t) verbose;
+    hdr.len = (uint32_t) len;
+
+    /* all in one go */
+    memset (&msg, 0, sizeof (msg));
+    iov[0].iov_base = &hdr;
+    iov[0].iov_len = sizeof (hdr);
+    iov[1].iov_base = payload;
+    iov[1].iov_len = len;
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof (control.buf);
+    cmsg = CMSG_FIRSTHDR (&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN (sizeof (fds));
+    memcpy (CMSG_DATA (cmsg), fds, sizeof (fds));
+
+    fflush (stdout);
+    if ((n = sendmsg (fd, &msg, MSG_NOSIGNAL)) < (ssize_t) sizeof (hdr))
+    {
+        n = -1;
+    }
+    /* a large environment might not fit at once */
+    for (s = payload + n - (ssize_t) sizeof (hdr); n > 0 && s < payload + len; s += n)
+    {
+        if ((n = write (fd, s, (size_t) (payload + len - s))) <= 0)
+        {
+            n = -1;
+        }
+    }
+    free (payload);
+    if (n < 0)
+    {
+        p (LVL_ERROR, "unable to send request: %s\n", strerror (errno));
+        close (fd);
+        return 1;
+    }
+
+    if (!read_all (fd, &hdr, sizeof (hdr)) || hdr.op != SERVICE_REPLY)
+    {
+        p (LVL_ERROR, "no reply from service\n");
+        close (fd);
+        return 1;
+    }
+    close (fd);
+    return hdr.flags;
+}
@@ -0,0 +1,70 @@
+/**
+ * dapper - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * service.h
+ * Copyright (C) 2012-2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of dapper.
+ *
+ * dapper is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * dapper is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * dapper. If not, see http://www.gnu.org/licenses/
+ */
+
+#ifndef __SERVICE_H__
+#define __SERVICE_H__
+
+#include <stdint.h>
+
+/* dapper --service keeps the parsed .desktop files in memory, and serves
+ * requests from dapper --client on a unix socket. A request is a header,
+ * followed by len bytes: the (NUL-terminated) name of the desktop/entry, then
+ * the client's environment, as NUL-terminated strings. Along with it, the
+ * client's stdout & stderr are passed (SCM_RIGHTS), so output goes there.
+ * The reply is only a header, with the exit status in flags */
+#define SERVICE_MAGIC       "DAPS"
+#define SERVICE_MAX_LEN     (1 << 20)
+
+#define SERVICE_AUTOSTART   1   /* start everything for desktop, empty for default */
+#define SERVICE_LAUNCH      2   /* only start the given entry, as --launch */
+#define SERVICE_REPLY       128
+
+#define SERVICE_DRY_RUN     (1 << 0)
+
+typedef struct
+{
+    char     magic[4];
+    uint8_t  op;
+    uint8_t  flags;
+    int8_t   verbose;
+    uint8_t  unused;
+    uint32_t len;
+} service_hdr_t;
+
+typedef struct
+{
+    int          op;
+    int          dry_run;
+    int          verbose;
+    const char  *name;
+    char       **env;       /* NULL-terminated */
+} service_req_t;
+
+/* processes a request, from a forked process; returns the exit status */
+typedef int  (*service_fn)     (const service_req_t *req, void *data);
+/* on SIGHUP, to scan & parse again */
+typedef void (*service_reload) (void *data);
+
+int service_run     (service_fn fn, service_reload reload, void *data);
+int service_request (int op, const char *name, int dry_run);
+
+#endif /* __SERVICE_H__ */
@@ -0,0 +1,576 @@
+/**
+ * dapper - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * sim.c
+ * Copyright (C) 2012-2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of dapper.
+ *
+ * dapper is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * dapper is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * dapper. If not, see http://www.gnu.org/licenses/
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "config.h"
+#include "dapper.h"
+#include "sim.h"
+#include "launch.h"
+
+/* an application's cost, in ms */
+typedef struct
+{
+    char    *name;      /* .desktop file name, or NULL for the default */
+    double   io;        /* time the (one) disk is busy loading it; the disk
+                         * serves apps one after the other */
+    double   cpu;       /* CPU time */
+    double   latency;   /* time it then takes to be ready, e.g. talking to
+                         * other processes */
+    int      notify;    /* notifies readiness (or has a ready file) */
+} cost_t;
+
+struct _sim_t
+{
+    cost_t  *costs;
+    int      nb;
+    cost_t   def;       /* for applications not in the model */
+    int      cpus;
+    int      parallel;  /* max apps starting at once, 0 for no limit */
+    double   stagger;   /* min time between two starts, in ms */
+};
+
+typedef enum {
+    PHASE_NONE = 0,     /* not started */
+    PHASE_HELD,         /* spawned by the scheduler, held by the throttle */
+    PHASE_IO,
+    PHASE_CPU,
+    PHASE_LATENCY,
+    PHASE_READY,
+} phase_t;
+
+typedef struct
+{
+    entry_t *entry;
+    cost_t  *cost;
+    int      index;     /* in processing order */
+    phase_t  phase;
+    double   left;      /* work left in the current phase */
+    int      io_seq;    /* place in the disk queue */
+    int      held_seq;  /* place in the throttle queue */
+    double   spawned;
+    double   ready;
+} app_t;
+
+/* one run of the actual scheduling code, on virtual time */
+typedef struct
+{
+    sim_t    *sim;
+    launch_t *launch;
+    app_t    *apps;     /* in the order they were added */
+    int       nb;
+    double    now;
+    int       starting; /* started, not ready yet */
+    int       io_seq;
+    int       held_seq;
+    int       peak;
+    int       parallel; /* throttle of this run, see sim_t */
+    double    stagger;
+    double    next_start;
+} run_t;
+
+typedef struct
+{
+    const char *name;
+    int       (*cmp) (const void *, const void *);
+    int         throttled;  /* with parallel/stagger from the model */
+} strategy_t;
+
+static double
+total_cost (const app_t *app)
+{
+    return app->cost->io + app->cost->cpu + app->cost->latency;
+}
+
+static int
+cmp_processed (const void *a1, const void *a2)
+{
+    return ((const app_t *) a1)->index - ((const app_t *) a2)->index;
+}
+
+static int
+cmp_cheapest (const void *a1, const void *a2)
+{
+    double c1 = total_cost (a1);
+    double c2 = total_cost (a2);
+
+    return (c1 < c2) ? -1 : (c1 > c2) ? 1 : cmp_processed (a1, a2);
+}
+
+static int
+cmp_costliest (const void *a1, const void *a2)
+{
+    return cmp_cheapest (a2, a1);
+}
+
+/* launch strategies replayed: the order applications are handed over to the
+ * scheduler, which then does as it would for real (dependencies, readiness);
+ * throttled ones also limit how many start at once, and how close together */
+static strategy_t strategies[] = {
+    { "as processed",       cmp_processed,  0 },
+    { "cheapest first",     cmp_cheapest,   0 },
+    { "costliest first",    cmp_costliest,  0 },
+    { "throttled",          cmp_processed,  1 },
+    { "throttled cheap",    cmp_cheapest,   1 },
+};
+
+/* parses a line "NAME IO CPU LATENCY [notify]" */
+static int
+parse_cost (char *line, cost_t *cost)
+{
+    char   *fields[5];
+    double *values[3] = { &cost->io, &cost->cpu, &cost->latency };
+    char   *e;
+    int     nb = 0;
+    int     i;
+
+    for (e = strtok (line, " \t"); e && nb < 5; e = strtok (NULL, " \t"))
+    {
+        fields[nb++] = e;
+    }
+    if (nb < 4 || e || (nb == 5 && strcmp (fields[4], "notify") != 0))
+    {
+        return 0;
+    }
+    for (i = 0; i < 3; ++i)
+    {
+        errno = 0;
+        *values[i] = strtod (fields[i + 1], &e);
+        if (errno || *e != '\0' || *values[i] < 0)
+        {
+            return 0;
+        }
+    }
+    cost->notify = (nb == 5);
+    cost->name = (strcmp (fields[0], "*") == 0) ? NULL : strdup (fields[0]);
+    return 1;
+}
+
+/* loads the cost model from file: one application per line, with its IO, CPU
+ * & latency costs in ms; "*" for the default; "cpus N" for the number of CPUs;
+ * "parallel N" & "stagger MS" for the throttled strategies */
+sim_t *
+sim_load (const char *file)
+{
+    FILE   *fp;
+    sim_t  *sim;
+    char    buf[1024];
+    char   *s;
+    int     line_nb = 0;
+    int     alloc = 0;
+
+    if (!(fp = fopen (file, "r")))
+    {
+        p (LVL_ERROR, "unable to open %s: %s\n", file, strerror (errno));
+        return NULL;
+    }
+
+    sim = calloc (1, sizeof (*sim));
+    sim->cpus = 1;
+    /* a small app, with no readiness notification */
+    sim->def.io = 50;
+    sim->def.cpu = 100;
+    sim->def.latency = 100;
+    while (fgets (buf, sizeof (buf), fp))
+    {
+        cost_t cost;
+
+        ++line_nb;
+        buf[strcspn (buf, "\r\n")] = '\0';
+        for (s = buf; *s == ' ' || *s == '\t'; ++s)
+            ;
+        if (*s == '\0' || *s == '#')
+        {
+            continue;
+        }
+        if (strncmp (s, "cpus ", 5) == 0)
+        {
+            sim->cpus = atoi (s + 5);
+            if (sim->cpus > 0)
+            {
+                continue;
+            }
+        }
+        else if (strncmp (s, "parallel ", 9) == 0)
+        {
+            sim->parallel = atoi (s + 9);
+            if (sim->parallel > 0)
+            {
+                continue;
+            }
+        }
+        else if (strncmp (s, "stagger ", 8) == 0)
+        {
+            errno = 0;
+            sim->stagger = strtod (s + 8, &s);
+            if (!errno && *s == '\0' && sim->stagger >= 0)
+            {
+                continue;
+            }
+        }
+        else if (parse_cost (s, &cost))
+        {
+            if (!cost.name)
+            {
+                sim->def = cost;
+                continue;
+            }
+            if (sim->nb == alloc)
+            {
+                alloc += 16;
+                sim->costs = realloc (sim->costs,
+                        sizeof (*sim->costs) * (size_t) alloc);
+            }
+            sim->costs[sim->nb++] = cost;
+            continue;
+        }
+        p (LVL_ERROR, "%s: invalid line %d\n", file, line_nb);
+        fclose (fp);
+        sim_free (sim);
+        return NULL;
+    }
+    fclose (fp);
+
+    return sim;
+}
+
+static cost_t *
+find_cost (sim_t *sim, const char *name)
+{
+    size_t l = strlen (name);
+    int    i;
+
+    /* with or without the .desktop suffix */
+    if (l > 8 && strcmp (name + l - 8, ".desktop") == 0)
+    {
+        l -= 8;
+    }
+    for (i = 0; i < sim->nb; ++i)
+    {
+        if (strncmp (sim->costs[i].name, name, l) == 0
+                && (sim->costs[i].name[l] == '\0'
+                    || strcmp (sim->costs[i].name + l, ".desktop") == 0))
+        {
+            return &sim->costs[i];
+        }
+    }
+    return &sim->def;
+}
+
+/* how fast app progresses through its current phase: the disk serves the first
+ * app in its queue, the CPUs are shared between all apps computing */
+static double
+rate (run_t *run, app_t *app, int io_head, int nb_cpu)
+{
+    switch (app->phase)
+    {
+        case PHASE_IO:
+            return (app->io_seq == io_head) ? 1.0 : 0.0;
+        case PHASE_CPU:
+            return (nb_cpu > run->sim->cpus) ? (double) run->sim->cpus / nb_cpu : 1.0;
+        case PHASE_LATENCY:
+            return 1.0;
+        default:
+            return 0.0;
+    }
+}
+
+static void
+next_phase (run_t *run, app_t *app)
+{
+    app->phase = (phase_t) (app->phase + 1);
+    switch (app->phase)
+    {
+        case PHASE_HELD:
+            app->held_seq = run->held_seq++;
+            break;
+        case PHASE_IO:
+            app->spawned = run->now;
+            app->left = app->cost->io;
+            app->io_seq = run->io_seq++;
+            if (++run->starting > run->peak)
+            {
+                run->peak = run->starting;
+            }
+            run->next_start = run->now + run->stagger;
+            break;
+        case PHASE_CPU:
+            app->left = app->cost->cpu;
+            break;
+        case PHASE_LATENCY:
+            app->left = app->cost->latency;
+            break;
+        default:
+            app->ready = run->now;
+            --run->starting;
+            p (LVL_VERBOSE, "%s: ready at %.3f s\n", app->entry->name, run->now / 1000);
+            if (app->cost->notify)
+            {
+                launch_ready (run->launch, (int) (app - run->apps));
+            }
+            break;
+    }
+}
+
+/* returns the first held app, if the throttle lets it start now (else, if
+ * that's only a matter of time, sets *wait to how long, in ms) */
+static app_t *
+next_held (run_t *run, double *wait)
+{
+    app_t *first = NULL;
+    int    i;
+
+    for (i = 0; i < run->nb; ++i)
+    {
+        if (run->apps[i].phase == PHASE_HELD
+                && (!first || run->apps[i].held_seq < first->held_seq))
+        {
+            first = &run->apps[i];
+        }
+    }
+    if (!first || (run->parallel > 0 && run->starting >= run->parallel))
+    {
+        return NULL;
+    }
+    if (run->next_start > run->now + 1e-9)
+    {
+        *wait = run->next_start - run->now;
+        return NULL;
+    }
+    return first;
+}
+
+/* starts held apps, as far as the throttle allows */
+static void
+release_held (run_t *run)
+{
+    app_t  *app;
+    double  wait;
+
+    while ((app = next_held (run, &wait)))
+    {
+        next_phase (run, app);
+    }
+}
+
+static int
+sim_spawn (void *data, int id, entry_t *entry)
+{
+    run_t *run = data;
+    app_t *app = &run->apps[id];
+
+    (void) entry;
+    /* it'll go through all its phases (even empty ones) from sim_wait() */
+    app->phase = PHASE_NONE;
+    next_phase (run, app);
+    release_held (run);
+    return 0;
+}
+
+static long long
+sim_now (void *data)
+{
+    return (long long) ((run_t *) data)->now;
+}
+
+/* advances virtual time to the next phase change, or timeout */
+static int
+sim_wait (void *data, long long timeout)
+{
+    run_t  *run = data;
+    double  next = -1;
+    double  wait = -1;
+    int     io_head = -1;
+    int     nb_cpu = 0;
+    int     i;
+
+    for (i = 0; i < run->nb; ++i)
+    {
+        if (run->apps[i].phase == PHASE_IO
+                && (io_head < 0 || run->apps[i].io_seq < io_head))
+        {
+            io_head = run->apps[i].io_seq;
+        }
+        nb_cpu += (run->apps[i].phase == PHASE_CPU);
+    }
+    for (i = 0; i < run->nb; ++i)
+    {
+        app_t  *app = &run->apps[i];
+        double  r = rate (run, app, io_head, nb_cpu);
+
+        if (r > 0 && (next < 0 || app->left / r < next))
+        {
+            next = app->left / r;
+        }
+    }
+    /* or until the throttle lets the next one start */
+    if (!next_held (run, &wait) && wait >= 0 && (next < 0 || wait < next))
+    {
+        next = wait;
+    }
+    if (next < 0 && timeout < 0)
+    {
+        return -1;
+    }
+    if (next < 0 || (timeout >= 0 && next > (double) timeout))
+    {
+        next = (double) timeout;
+    }
+
+    for (i = 0; i < run->nb; ++i)
+    {
+        app_t *app = &run->apps[i];
+
+        app->left -= rate (run, app, io_head, nb_cpu) * next;
+    }
+    run->now += next;
+    for (i = 0; i < run->nb; ++i)
+    {
+        app_t *app = &run->apps[i];
+
+        /* a phase can be over right away, if it costs nothing */
+        while (app->phase > PHASE_HELD && app->phase < PHASE_READY
+                && app->left <= 1e-9)
+        {
+            next_phase (run, app);
+        }
+    }
+    release_held (run);
+    return 0;
+}
+
+static void
+run_strategy (sim_t *sim, app_t *apps, int nb, const strategy_t *strategy)
+{
+    launch_backend_t backend = { NULL, sim_spawn, sim_now, sim_wait };
+    struct timespec  ts_start = { 0, 0 };
+    run_t            run;
+    double           last_spawn = 0;
+    double           all_ready = 0;
+    int              nb_spawned = 0;
+    int              i;
+
+    memset (&run, 0, sizeof (run));
+    run.sim = sim;
+    run.apps = apps;
+    run.nb = nb;
+    if (strategy->throttled)
+    {
+        run.parallel = sim->parallel;
+        run.stagger = sim->stagger;
+    }
+    backend.data = &run;
+    qsort (apps, (size_t) nb, sizeof (*apps), strategy->cmp);
+    for (i = 0; i < nb; ++i)
+    {
+        apps[i].phase = PHASE_NONE;
+        apps[i].spawned = apps[i].ready = -1;
+    }
+
+    p (LVL_VERBOSE, "\nsimulating: %s\n", strategy->name);
+    run.launch = launch_new (NULL, 0, &ts_start, &backend);
+    for (i = 0; i < nb; ++i)
+    {
+        launch_add (run.launch, apps[i].entry);
+    }
+    launch_run (run.launch);
+    /* everything was started; let it all get ready */
+    while (sim_wait (&run, -1) == 0)
+        ;
+    launch_free (run.launch);
+
+    for (i = 0; i < nb; ++i)
+    {
+        if (apps[i].spawned < 0)
+        {
+            continue;
+        }
+        ++nb_spawned;
+        if (apps[i].spawned > last_spawn)
+        {
+            last_spawn = apps[i].spawned;
+        }
+        if (apps[i].ready > all_ready)
+        {
+            all_ready = apps[i].ready;
+        }
+    }
+    p (LVL_NORMAL, "%-16s %3d %9.3f s %9.3f s %6d\n", strategy->name, nb_spawned,
+            last_spawn / 1000, all_ready / 1000, run.peak);
+}
+
+/* replays the launch of entries for each strategy, on virtual time, and prints
+ * time to the last spawn & to all ready, and the peak number of apps starting */
+void
+sim_run (sim_t *sim, entry_t *entries)
+{
+    entry_t *entry;
+    app_t   *apps = NULL;
+    int      nb = 0;
+    int      alloc = 0;
+    size_t   i;
+
+    for (entry = entries; entry; entry = entry->next)
+    {
+        if (nb == alloc)
+        {
+            alloc += 16;
+            apps = realloc (apps, sizeof (*apps) * (size_t) alloc);
+        }
+        memset (&apps[nb], 0, sizeof (*apps));
+        apps[nb].entry = entry;
+        apps[nb].cost = find_cost (sim, entry->name);
+        apps[nb].index = nb;
+        ++nb;
+    }
+
+    p (LVL_NORMAL, "%-16s %3s %11s %11s %6s\n", "strategy", "nb",
+            "last spawn", "all ready", "peak");
+    for (i = 0; i < sizeof (strategies) / sizeof (*strategies); ++i)
+    {
+        /* only if the model sets a throttle */
+        if (strategies[i].throttled && sim->parallel == 0 && sim->stagger <= 0)
+        {
+            continue;
+        }
+        run_strategy (sim, apps, nb, &strategies[i]);
+    }
+    free (apps);
+}
+
+void
+sim_free (sim_t *sim)
+{
+    int i;
+
+    for (i = 0; i < sim->nb; ++i)
+    {
+        free (sim->costs[i].name);
+    }
+    free (sim->costs);
+    free (sim);
+}
@@ -0,0 +1,465 @@
+/**
+ * dapper - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * sysindex.c
+ * Copyright (C) 2012-2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of dapper.
+ *
+ * dapper is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * dapper is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * dapper. If not, see http://www.gnu.org/licenses/
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "dapper.h"
+#include "sysindex.h"
+
+/* 8 for magic, then numbers of folders & files, BOM and unused */
+#define HEADER_LEN      (8 + 4 * sizeof (uint32_t))
+
+struct _sysindex_t
+{
+    char                  *map;
+    size_t                 size;
+    uint32_t               nb_dirs;
+    uint32_t               len;
+    const sysindex_dir_t  *dirs;
+    const sysindex_file_t *files;
+};
+
+static uint64_t
+get_mtime (const struct stat *st)
+{
+    return (uint64_t) st->st_mtim.tv_sec * 1000000000 + (uint64_t) st->st_mtim.tv_nsec;
+}
+
+static int
+is_name (sysindex_t *idx, uint32_t off)
+{
+    return off < idx->size && memchr (idx->map + off, '\0', idx->size - off);
+}
+
+/* maps path and makes sure it is a valid index, so accessors don't need any
+ * checks. Whether it is current is up to sysindex_is_current() */
+sysindex_t *
+sysindex_open (const char *path)
+{
+    sysindex_t *idx;
+    struct stat st;
+    uint32_t    hdr[4];
+    uint32_t    i;
+    size_t      max;
+    char       *map;
+    int         fd;
+
+    if ((fd = open (path, O_RDONLY | O_CLOEXEC)) < 0)
+    {
+        if (errno == ENOENT)
+        {
+            p (LVL_VERBOSE, "no system index %s\n", path);
+        }
+        else
+        {
+            p (LVL_ERROR, "failed to open %s: %s\n", path, strerror (errno));
+        }
+        return NULL;
+    }
+    if (fstat (fd, &st) < 0 || (size_t) st.st_size < HEADER_LEN)
+    {
+        p (LVL_ERROR, "%s: not a system index\n", path);
+        close (fd);
+        return NULL;
+    }
+    map = mmap (NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED)
+    {
+        p (LVL_ERROR, "%s: unable to mmap: %s\n", path, strerror (errno));
+        return NULL;
+    }
+
+    memcpy (hdr, map + 8, sizeof (hdr));
+    max = (size_t) st.st_size - HEADER_LEN;
+    if (memcmp (map, SYSINDEX_MAGIC, 8) != 0 || hdr[2] != SYSINDEX_BOM
+            || hdr[0] > max / sizeof (sysindex_dir_t)
+            || hdr[1] > (max - hdr[0] * sizeof (sysindex_dir_t)) / sizeof (sysindex_file_t))
+    {
+        p (LVL_ERROR, "%s: not a system index\n", path);
+        munmap (map, (size_t) st.st_size);
+        return NULL;
+    }
+
+    idx = malloc (sizeof (*idx));
+    idx->map = map;
+    idx->size = (size_t) st.st_size;
+    idx->nb_dirs = hdr[0];
+    idx->len = hdr[1];
+    idx->dirs = (const sysindex_dir_t *) (const void *) (map + HEADER_LEN);
+    idx->files = (const sysindex_file_t *) (const void *) (idx->dirs + idx->nb_dirs);
+
+    for (i = 0; i < idx->nb_dirs; ++i)
+    {
+        if (!is_name (idx, idx->dirs[i].name_off))
+        {
+            p (LVL_ERROR, "%s: corrupted system index (folder %u)\n", path, i);
+            sysindex_close (idx);
+            return NULL;
+        }
+    }
+    for (i = 0; i < idx->len; ++i)
+    {
+        const sysindex_file_t *f = &idx->files[i];
+
+        if (f->dir >= idx->nb_dirs || !is_name (idx, f->name_off)
+                || f->data_off > idx->size
+                || f->data_len > idx->size - f->data_off)
+        {
+            p (LVL_ERROR, "%s: corrupted system index (file %u)\n", path, i);
+            sysindex_close (idx);
+            return NULL;
+        }
+    }
+
+    madvise (map, idx->size, MADV_WILLNEED);
+    p (LVL_DEBUG, "%s: system index of %u folders, %u files\n",
+            path, idx->nb_dirs, idx->len);
+    return idx;
+}
+
+int
+sysindex_nb_dirs (sysindex_t *idx)
+{
+    return (int) idx->nb_dirs;
+}
+
+const char *
+sysindex_dir (sysindex_t *idx, int i)
+{
+    return idx->map + idx->dirs[i].name_off;
+}
+
+/* returns 1 if no folder or file changed since the index was built. Only
+ * metadata are checked, i.e. no file is read */
+int
+sysindex_is_current (sysindex_t *idx)
+{
+    struct stat st;
+    const char *dir;
+    char        buf[4096];
+    uint32_t    i;
+
+    for (i = 0; i < idx->nb_dirs; ++i)
+    {
+        dir = sysindex_dir (idx, (int) i);
+        if (stat (dir, &st) < 0)
+        {
+            if (errno == ENOENT && idx->dirs[i].mtime == 0)
+            {
+                continue;
+            }
+        }
+        else if (get_mtime (&st) == idx->dirs[i].mtime)
+        {
+            continue;
+        }
+        p (LVL_VERBOSE, "%s: changed since system index was built\n", dir);
+        return 0;
+    }
+    for (i = 0; i < idx->len; ++i)
+    {
+        snprintf (buf, sizeof (buf), "%s/%s", sysindex_file_dir (idx, (int) i),
+                sysindex_name (idx, (int) i));
+        if (stat (buf, &st) < 0 || get_mtime (&st) != idx->files[i].mtime
+                || (uint64_t) st.st_size != idx->files[i].size)
+        {
+            p (LVL_VERBOSE, "%s: changed since system index was built\n", buf);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int
+sysindex_len (sysindex_t *idx)
+{
+    return (int) idx->len;
+}
+
+const char *
+sysindex_file_dir (sysindex_t *idx, int i)
+{
+    return sysindex_dir (idx, (int) idx->files[i].dir);
+}
+
+const char *
+sysindex_name (sysindex_t *idx, int i)
+{
+    return idx->map + idx->files[i].name_off;
+}
+
+const char *
+sysindex_data (sysindex_t *idx, int i, size_t *len)
+{
+    *len = idx->files[i].data_len;
+    return idx->map + idx->files[i].data_off;
+}
+
+void
+sysindex_close (sysindex_t *idx)
+{
+    munmap (idx->map, idx->size);
+    free (idx);
+}
+
+static int
+write_all (int fd, const void *buf, size_t len)
+{
+    const char *s = buf;
+    ssize_t     w;
+
+    while (len > 0)
+    {
+        if ((w = write (fd, s, len)) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return 0;
+        }
+        s += w;
+        len -= (size_t) w;
+    }
+    return 1;
+}
+
+/* reads all .desktop files from dirs, in order of precedence (i.e. only the
+ * first one of a given name), into index out. Returns 0 on success */
+int
+sysindex_build (const char **dirs, int nb, const char *out)
+{
+    DIR             *dp;
+    struct dirent   *dirent;
+    struct stat      st;
+    sysindex_dir_t  *idirs;
+    sysindex_file_t *files = NULL;
+    char           **names = NULL;
+    char           **datas = NULL;
+    size_t           alloc = 0;
+    size_t           len   = 0;
+    size_t           off;
+    size_t           l;
+    size_t           i;
+    uint32_t         hdr[4];
+    char            *tmp   = NULL;
+    char             buf[4096];
+    int              d;
+    int              fd;
+    int              ret   = 1;
+
+    idirs = calloc ((size_t) nb, sizeof (*idirs));
+    for (d = 0; d < nb; ++d)
+    {
+        /* before reading it, so a change while we do makes the index stale */
+        if (stat (dirs[d], &st) < 0)
+        {
+            if (errno == ENOENT)
+            {
+                p (LVL_VERBOSE, "skip: %s does not exists\n", dirs[d]);
+                continue;
+            }
+            p (LVL_ERROR, "failed to stat %s: %s\n", dirs[d], strerror (errno));
+            goto done;
+        }
+        idirs[d].mtime = get_mtime (&st);
+        if (!(dp = opendir (dirs[d])))
+        {
+            /* bundles aren't supported, since they're already one file */
+            p (LVL_ERROR, "failed to open %s: %s\n", dirs[d], strerror (errno));
+            goto done;
+        }
+        while ((dirent = readdir (dp)))
+        {
+            l = strlen (dirent->d_name);
+            /* 8 == strlen (".desktop") */
+            if (l < 8 || strcmp (".desktop", &dirent->d_name[l - 8]) != 0)
+            {
+                continue;
+            }
+            for (i = 0; i < len; ++i)
+            {
+                if (strcmp (names[i], dirent->d_name) == 0)
+                {
+                    break;
+                }
+            }
+            if (i < len)
+            {
+                p (LVL_VERBOSE, "%s/%s: name already indexed, ignoring\n",
+                        dirs[d], dirent->d_name);
+                continue;
+            }
+
+            snprintf (buf, sizeof (buf), "%s/%s", dirs[d], dirent->d_name);
+            if ((fd = open (buf, O_RDONLY | O_CLOEXEC)) < 0
+                    || fstat (fd, &st) < 0 || !S_ISREG (st.st_mode))
+            {
+                /* not a file, like when scanning a folder */
+                p (LVL_VERBOSE, "%s: not a file, ignoring\n", buf);
+                if (fd >= 0)
+                {
+                    close (fd);
+                }
+                continue;
+            }
+            if (len == alloc)
+            {
+                alloc += 32;
+                names = realloc (names, sizeof (*names) * alloc);
+                datas = realloc (datas, sizeof (*datas) * alloc);
+                files = realloc (files, sizeof (*files) * alloc);
+            }
+            memset (&files[len], 0, sizeof (*files));
+            files[len].dir = (uint32_t) d;
+            files[len].mtime = get_mtime (&st);
+            files[len].size = (uint64_t) st.st_size;
+            files[len].data_len = (uint32_t) st.st_size;
+            names[len] = strdup (dirent->d_name);
+            datas[len] = malloc ((size_t) st.st_size + 1);
+            ++len;
+            if ((size_t) st.st_size > UINT32_MAX
+                    || read (fd, datas[len - 1], (size_t) st.st_size) != st.st_size)
+            {
+                p (LVL_ERROR, "%s: unable to read file\n", buf);
+                close (fd);
+                closedir (dp);
+                goto done;
+            }
+            close (fd);
+            p (LVL_VERBOSE, "%s: indexed (%zu bytes)\n", buf, (size_t) st.st_size);
+        }
+        closedir (dp);
+    }
+
+    /* offsets: folder names, file names, then data */
+    off = HEADER_LEN + (size_t) nb * sizeof (*idirs) + len * sizeof (*files);
+    for (d = 0; d < nb; ++d)
+    {
+        idirs[d].name_off = (uint32_t) off;
+        off += strlen (dirs[d]) + 1;
+    }
+    for (i = 0; i < len; ++i)
+    {
+        files[i].name_off = (uint32_t) off;
+        off += strlen (names[i]) + 1;
+    }
+    for (i = 0; i < len; ++i)
+    {
+        if (off + files[i].data_len > UINT32_MAX)
+        {
+            p (LVL_ERROR, "%s: system index too large\n", out);
+            goto done;
+        }
+        files[i].data_off = (uint32_t) off;
+        off += files[i].data_len;
+    }
+
+    /* write to a temp file, renamed once complete, so runs in progress keep
+     * the old one mapped. A new one, not to follow a symlink put there */
+    tmp = malloc (strlen (out) + 8);
+    sprintf (tmp, "%s.XXXXXX", out);
+    if ((fd = mkostemp (tmp, O_CLOEXEC)) < 0)
+    {
+        p (LVL_ERROR, "failed to create %s: %s\n", tmp, strerror (errno));
+        goto done;
+    }
+    /* for all users to read */
+    if (fchmod (fd, 0644) < 0)
+    {
+        goto write_error;
+    }
+    hdr[0] = (uint32_t) nb;
+    hdr[1] = (uint32_t) len;
+    hdr[2] = SYSINDEX_BOM;
+    hdr[3] = 0;
+    if (!write_all (fd, SYSINDEX_MAGIC, 8)
+            || !write_all (fd, hdr, sizeof (hdr))
+            || !write_all (fd, idirs, (size_t) nb * sizeof (*idirs))
+            || !write_all (fd, files, len * sizeof (*files)))
+    {
+        goto write_error;
+    }
+    for (d = 0; d < nb; ++d)
+    {
+        if (!write_all (fd, dirs[d], strlen (dirs[d]) + 1))
+        {
+            goto write_error;
+        }
+    }
+    for (i = 0; i < len; ++i)
+    {
+        if (!write_all (fd, names[i], strlen (names[i]) + 1))
+        {
+            goto write_error;
+        }
+    }
+    for (i = 0; i < len; ++i)
+    {
+        if (!write_all (fd, datas[i], files[i].data_len))
+        {
+            goto write_error;
+        }
+    }
+    if (close (fd) < 0 || rename (tmp, out) < 0)
+    {
+        fd = -1;
+        goto write_error;
+    }
+
+    p (LVL_NORMAL, "indexed %zu files from %d folders into %s (%zu bytes)\n",
+            len, nb, out, off);
+    ret = 0;
+    goto done;
+
+write_error:
+    p (LVL_ERROR, "failed to write %s: %s\n", tmp, strerror (errno));
+    if (fd >= 0)
+    {
+        close (fd);
+    }
+    unlink (tmp);
+done:
+    for (i = 0; i < len; ++i)
+    {
+        free (names[i]);
+        free (datas[i]);
+    }
+    free (names);
+    free (datas);
+    free (files);
+    free (idirs);
+    free (tmp);
+    return ret;
+}
@@ -0,0 +1,80 @@
+/**
+ * dapper - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * sysindex.h
+ * Copyright (C) 2012-2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of dapper.
+ *
+ * dapper is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * dapper is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * dapper. If not, see http://www.gnu.org/licenses/
+ */
+
+#ifndef __SYSINDEX_H__
+#define __SYSINDEX_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* The system index holds the .desktop files from the system folders, as they
+ * are to be processed (i.e. only the first one of a given name), so per-user
+ * runs can map it (sharing its pages) instead of reading those folders. It
+ * also has what's needed to tell when it got stale. Layout (native byte
+ * order):
+ *
+ *  header      magic "DAPPERI1", uint32 number of folders, uint32 number of
+ *              files, uint32 SYSINDEX_BOM, uint32 unused
+ *  folders     one sysindex_dir_t per folder, in order of precedence
+ *  files       one sysindex_file_t per file, by folder
+ *  names       NUL-terminated names of the folders & .desktop files
+ *  data        content of the .desktop files
+ */
+#define SYSINDEX_MAGIC      "DAPPERI1"
+#define SYSINDEX_BOM        0x01020304
+
+/* set from localstatedir by the build */
+#ifndef SYSINDEX_FILE
+#define SYSINDEX_FILE       "/var/cache/dapper/system.index"
+#endif
+
+typedef struct
+{
+    uint64_t mtime;     /* in ns; 0 if the folder didn't exist */
+    uint32_t name_off;
+    uint32_t unused;
+} sysindex_dir_t;
+
+typedef struct
+{
+    uint64_t mtime;     /* in ns */
+    uint64_t size;
+    uint32_t dir;       /* index of its folder */
+    uint32_t name_off;
+    uint32_t data_off;
+    uint32_t data_len;
+} sysindex_file_t;
+
+typedef struct _sysindex_t sysindex_t;
+
+sysindex_t *sysindex_open       (const char *path);
+int         sysindex_nb_dirs    (sysindex_t *idx);
+const char *sysindex_dir        (sysindex_t *idx, int i);
+int         sysindex_is_current (sysindex_t *idx);
+int         sysindex_len        (sysindex_t *idx);
+const char *sysindex_file_dir   (sysindex_t *idx, int i);
+const char *sysindex_name       (sysindex_t *idx, int i);
+const char *sysindex_data       (sysindex_t *idx, int i, size_t *len);
+void        sysindex_close      (sysindex_t *idx);
+int         sysindex_build      (const char **dirs, int nb, const char *out);
+
+#endif /* __SYSINDEX_H__ */
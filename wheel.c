@@ -0,0 +1,230 @@
+/**
+ * dapper - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * wheel.c
+ * Copyright (C) 2012-2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of dapper.
+ *
+ * dapper is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * dapper is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * dapper. If not, see http://www.gnu.org/licenses/
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "config.h"
+#include "dapper.h"
+#include "wheel.h"
+
+/* a hashed timer wheel: timers go in the slot of their tick, and a single
+ * timerfd is armed for the next one due. Delays are usually in seconds, so
+ * 100 ms ticks are plenty; one revolution covers 25.6s, timers further away
+ * are simply skipped until their tick comes around */
+#define WHEEL_TICK      100     /* in ms */
+#define WHEEL_SLOTS     256
+
+typedef struct
+{
+    long    tick;       /* when it's due, in ticks since ref */
+    int     id;
+    int     next;       /* in the same slot, -1 for none */
+} wtimer_t;
+
+struct _wheel_t
+{
+    struct timespec ref;
+    int             fd;
+    int             slots[WHEEL_SLOTS];  /* index of first timer, or -1 */
+    wtimer_t       *timers;
+    int             alloc;
+    int             len;
+    int             nb_pending;
+    long            last_tick;  /* ticks up to it were processed */
+};
+
+/* current tick, since ref */
+static long
+get_tick (wheel_t *wheel)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ((ts.tv_sec - wheel->ref.tv_sec) * 1000
+            + (ts.tv_nsec - wheel->ref.tv_nsec) / 1000000) / WHEEL_TICK;
+}
+
+/* arms the timerfd for the earliest pending timer, or disarms it. Slots are
+ * walked from the first tick not processed, for one revolution at most; when
+ * all timers are further away, it fires after that revolution anyways */
+static void
+arm (wheel_t *wheel)
+{
+    struct itimerspec its;
+    long              next = -1;
+    long              tick;
+    int               t;
+
+    memset (&its, 0, sizeof (its));
+    for (tick = wheel->last_tick + 1;
+            wheel->nb_pending > 0 && next < 0
+            && tick <= wheel->last_tick + WHEEL_SLOTS;
+            ++tick)
+    {
+        for (t = wheel->slots[tick % WHEEL_SLOTS]; t >= 0; t = wheel->timers[t].next)
+        {
+            if (wheel->timers[t].tick == tick)
+            {
+                next = tick;
+                break;
+            }
+        }
+    }
+    if (wheel->nb_pending > 0 && next < 0)
+    {
+        next = wheel->last_tick + WHEEL_SLOTS;
+    }
+    if (next >= 0)
+    {
+        long ms = next * WHEEL_TICK;
+
+        its.it_value.tv_sec = wheel->ref.tv_sec + ms / 1000;
+        its.it_value.tv_nsec = wheel->ref.tv_nsec + (ms % 1000) * 1000000;
+        if (its.it_value.tv_nsec >= 1000000000)
+        {
+            ++its.it_value.tv_sec;
+            its.it_value.tv_nsec -= 1000000000;
+        }
+        /* 0 would disarm it */
+        if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+        {
+            its.it_value.tv_nsec = 1;
+        }
+    }
+    timerfd_settime (wheel->fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/* ref is the reference point (on CLOCK_MONOTONIC) all delays are relative to;
+ * the timerfd is added to epfd with ev as data */
+wheel_t *
+wheel_new (const struct timespec *ref, int epfd, uint64_t ev)
+{
+    struct epoll_event  event;
+    wheel_t            *wheel;
+    int                 i;
+
+    wheel = calloc (1, sizeof (*wheel));
+    wheel->ref = *ref;
+    if ((wheel->fd = timerfd_create (CLOCK_MONOTONIC,
+                    TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+    {
+        p (LVL_ERROR, "unable to create timerfd: %s\n", strerror (errno));
+        free (wheel);
+        return NULL;
+    }
+    event.events = EPOLLIN;
+    event.data.u64 = ev;
+    epoll_ctl (epfd, EPOLL_CTL_ADD, wheel->fd, &event);
+    for (i = 0; i < WHEEL_SLOTS; ++i)
+    {
+        wheel->slots[i] = -1;
+    }
+    wheel->last_tick = -1;
+    return wheel;
+}
+
+/* adds timer id, due ms after ref */
+void
+wheel_add (wheel_t *wheel, long ms, int id)
+{
+    wtimer_t *timer;
+    int       slot;
+
+    if (wheel->len == wheel->alloc)
+    {
+        wheel->alloc += 16;
+        wheel->timers = realloc (wheel->timers,
+                sizeof (*wheel->timers) * (size_t) wheel->alloc);
+    }
+    timer = &wheel->timers[wheel->len];
+    /* rounded up, not to fire early; ticks already processed are due next */
+    timer->tick = (ms + WHEEL_TICK - 1) / WHEEL_TICK;
+    if (timer->tick <= wheel->last_tick)
+    {
+        timer->tick = wheel->last_tick + 1;
+    }
+    timer->id = id;
+    slot = (int) (timer->tick % WHEEL_SLOTS);
+    timer->next = wheel->slots[slot];
+    wheel->slots[slot] = wheel->len++;
+    ++wheel->nb_pending;
+    arm (wheel);
+}
+
+/* calls fn for all timers due, when the timerfd fired; fn mustn't add timers */
+void
+wheel_expire (wheel_t *wheel, wheel_fn fn, void *data)
+{
+    uint64_t  n;
+    long      now = get_tick (wheel);
+    long      tick;
+    int      *t;
+
+    while (read (wheel->fd, &n, sizeof (n)) > 0)
+        ;
+
+    /* past a whole revolution, all slots have been walked through */
+    tick = wheel->last_tick + 1;
+    if (now - tick >= WHEEL_SLOTS)
+    {
+        tick = now - WHEEL_SLOTS + 1;
+    }
+    for ( ; tick <= now; ++tick)
+    {
+        t = &wheel->slots[tick % WHEEL_SLOTS];
+        while (*t >= 0)
+        {
+            wtimer_t *timer = &wheel->timers[*t];
+
+            if (timer->tick <= now)
+            {
+                int id = timer->id;
+
+                timer->id = -1;
+                *t = timer->next;
+                --wheel->nb_pending;
+                fn (id, data);
+            }
+            else
+            {
+                t = &timer->next;
+            }
+        }
+    }
+    wheel->last_tick = now;
+    arm (wheel);
+}
+
+void
+wheel_free (wheel_t *wheel)
+{
+    close (wheel->fd);
+    free (wheel->timers);
+    free (wheel);
+}
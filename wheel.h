@@ -0,0 +1,38 @@
+/**
+ * dapper - Copyright (C) 2012-2013 Olivier Brunel
+ *
+ * wheel.h
+ * Copyright (C) 2012-2013 Olivier Brunel <i.am.jack.mail@gmail.com>
+ *
+ * This file is part of dapper.
+ *
+ * dapper is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * dapper is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * dapper. If not, see http://www.gnu.org/licenses/
+ */
+
+#ifndef __WHEEL_H__
+#define __WHEEL_H__
+
+#include <stdint.h>
+#include <time.h>
+
+typedef struct _wheel_t wheel_t;
+
+typedef void (*wheel_fn) (int id, void *data);
+
+wheel_t *wheel_new      (const struct timespec *ref, int epfd, uint64_t ev);
+void     wheel_add      (wheel_t *wheel, long ms, int id);
+void     wheel_expire   (wheel_t *wheel, wheel_fn fn, void *data);
+void     wheel_free     (wheel_t *wheel);
+
+#endif /* __WHEEL_H__ */